@@ -0,0 +1,275 @@
+// Host benchmark of the JSON parsing done by refreshWeather() and
+// refreshForecast(): JsonExtract against ArduinoJson, on the recorded
+// responses in lib/NativeShims/fixtures (EPAPER_FIXTURES to use others).
+//
+//   pio run -e native_bench && .pio/build/native_bench/program
+//
+// Times are the mean of ITERATIONS parses from memory. RAM is the peak stack
+// depth of one parse, measured by painting the stack beforehand, and the
+// peak the parse takes from the heap, counted by the malloc() below; the
+// documents of ArduinoJson are part of it.
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <JsonExtract.h>
+
+#include <malloc.h>
+
+#include <string>
+
+#define ITERATIONS 2000
+#define STACK_PAINT_SIZE 32768
+#define STACK_GUARD 256
+#define STACK_PAINT 0xA5
+#define FORECAST_SLOTS 40
+
+// Heap use while `heapCounting`: malloc() and free() of glibc, which
+// operator new and ArduinoJson's allocator go through, are wrapped to keep
+// the bytes in use and their peak
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static bool heapCounting = false;
+static size_t heapUsed = 0;
+static size_t heapPeak = 0;
+
+static void *counted(void *ptr) {
+  if (ptr && heapCounting) {
+    heapUsed += malloc_usable_size(ptr);
+    heapPeak = max(heapPeak, heapUsed);
+  }
+  return ptr;
+}
+
+extern "C" void *malloc(size_t size) {
+  return counted(__libc_malloc(size));
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+  return counted(__libc_calloc(count, size));
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  if (ptr && heapCounting) heapUsed -= malloc_usable_size(ptr);
+  return counted(__libc_realloc(ptr, size));
+}
+
+extern "C" void free(void *ptr) {
+  if (ptr && heapCounting) heapUsed -= malloc_usable_size(ptr);
+  __libc_free(ptr);
+}
+
+// A response body already received
+class MemoryStream : public Stream {
+  public:
+    MemoryStream(const std::string &data) : _data(data) {}
+    void rewind() { _pos = 0; }
+    int available() override { return _data.size() - _pos; }
+    int read() override { return _pos < _data.size() ? (uint8_t)_data[_pos++] : -1; }
+    int peek() override { return _pos < _data.size() ? (uint8_t)_data[_pos] : -1; }
+    size_t write(uint8_t c) override { return 0; }
+    using Print::write;
+
+  private:
+    const std::string &_data;
+    size_t _pos = 0;
+};
+
+struct Weather {
+  long dt;
+  int offset;
+  float temp;
+  char icon[4];
+  long sunrise;
+  long sunset;
+};
+
+struct Forecast {
+  int count;
+  long dt[FORECAST_SLOTS];
+  int temp[FORECAST_SLOTS];
+  char icon[FORECAST_SLOTS][4];
+};
+
+bool weatherArduinoJson(Stream &stream, Weather *weather) {
+  StaticJsonDocument<1024> doc;
+  if (deserializeJson(doc, stream)) return false;
+  weather->dt = doc["dt"];
+  weather->offset = doc["timezone"];
+  weather->temp = doc["main"]["temp"];
+  strlcpy(weather->icon, doc["weather"][0]["icon"] | "", sizeof(weather->icon));
+  weather->sunrise = doc["sys"]["sunrise"];
+  weather->sunset = doc["sys"]["sunset"];
+  return true;
+}
+
+bool weatherExtract(Stream &stream, Weather *weather) {
+  const JsonField fields[] = {
+    {"dt", JSON_LONG, &weather->dt, 0},
+    {"timezone", JSON_INT, &weather->offset, 0},
+    {"main.temp", JSON_FLOAT, &weather->temp, 0},
+    {"weather[0].icon", JSON_STRING, weather->icon, sizeof(weather->icon)},
+    {"sys.sunrise", JSON_LONG, &weather->sunrise, 0},
+    {"sys.sunset", JSON_LONG, &weather->sunset, 0},
+  };
+  return extractJson(stream, fields, sizeof(fields) / sizeof(fields[0]));
+}
+
+// What refreshForecast() did before streaming: the whole filtered list in
+// one document
+bool forecastArduinoJsonDocument(Stream &stream, Forecast *forecast) {
+  DynamicJsonDocument doc(8192);
+  StaticJsonDocument<160> filter;
+  JsonObject filter_list_0 = filter["list"].createNestedObject();
+  filter_list_0["dt"] = true;
+  filter_list_0["main"]["temp"] = true;
+  filter_list_0["weather"][0]["icon"] = true;
+  if (deserializeJson(doc, stream, DeserializationOption::Filter(filter))) return false;
+
+  forecast->count = 0;
+  for (JsonObject item : doc["list"].as<JsonArray>()) {
+    if (forecast->count == FORECAST_SLOTS) break;
+    forecast->dt[forecast->count] = item["dt"];
+    forecast->temp[forecast->count] = item["main"]["temp"];
+    strlcpy(forecast->icon[forecast->count], item["weather"][0]["icon"] | "", 4);
+    forecast->count++;
+  }
+  return true;
+}
+
+// refreshForecast() with ArduinoJson: one entry at a time
+bool forecastArduinoJson(Stream &stream, Forecast *forecast) {
+  if (!stream.find("\"list\":[")) return false;
+  StaticJsonDocument<96> filter;
+  filter["dt"] = true;
+  filter["main"]["temp"] = true;
+  filter["weather"][0]["icon"] = true;
+  StaticJsonDocument<192> item;
+
+  forecast->count = 0;
+  do {
+    if (deserializeJson(item, stream, DeserializationOption::Filter(filter))) return false;
+    forecast->dt[forecast->count] = item["dt"];
+    forecast->temp[forecast->count] = item["main"]["temp"];
+    strlcpy(forecast->icon[forecast->count], item["weather"][0]["icon"] | "", 4);
+    forecast->count++;
+  } while (forecast->count < FORECAST_SLOTS && stream.findUntil(",", "]"));
+  return true;
+}
+
+// refreshForecast() as it is
+bool forecastExtract(Stream &stream, Forecast *forecast) {
+  if (!stream.find("\"list\":[")) return false;
+  long dt;
+  int temp;
+  char icon[4];
+  const JsonField fields[] = {
+    {"dt", JSON_LONG, &dt, 0},
+    {"main.temp", JSON_INT, &temp, 0},
+    {"weather[0].icon", JSON_STRING, icon, sizeof(icon)},
+  };
+
+  forecast->count = 0;
+  do {
+    dt = 0;
+    temp = 0;
+    icon[0] = '\0';
+    if (!extractJson(stream, fields, sizeof(fields) / sizeof(fields[0]))) return false;
+    forecast->dt[forecast->count] = dt;
+    forecast->temp[forecast->count] = temp;
+    strlcpy(forecast->icon[forecast->count], icon, 4);
+    forecast->count++;
+  } while (forecast->count < FORECAST_SLOTS && stream.findUntil(",", "]"));
+  return true;
+}
+
+// The stack the parse is going to use: STACK_PAINT_SIZE bytes below the
+// frame of paintStack(), which sits where the frame of the parse will be
+// when both are called from run(). The top STACK_GUARD bytes are left alone,
+// they may hold what a leaf function keeps below its stack pointer.
+static uint8_t *stackTop;
+
+__attribute__((noinline)) void paintStack() {
+  stackTop = (uint8_t *)__builtin_frame_address(0);
+  volatile uint8_t *area = stackTop - STACK_PAINT_SIZE;
+  for (size_t i = 0; i < STACK_PAINT_SIZE - STACK_GUARD; i++) area[i] = STACK_PAINT;
+}
+
+// Bytes between the top and the deepest byte the parse wrote
+__attribute__((noinline)) size_t stackUsed() {
+  volatile uint8_t *area = stackTop - STACK_PAINT_SIZE;
+  size_t untouched = 0;
+  while (untouched < STACK_PAINT_SIZE - STACK_GUARD && area[untouched] == STACK_PAINT) untouched++;
+  return STACK_PAINT_SIZE - untouched;
+}
+
+template <typename Result>
+void run(const char *name, const std::string &body, bool (*parse)(Stream &, Result *), Result *result) {
+  MemoryStream stream(body);
+
+  heapUsed = 0;
+  heapPeak = 0;
+  heapCounting = true;
+  paintStack();
+  bool ok = parse(stream, result);
+  size_t stack = stackUsed();
+  heapCounting = false;
+  size_t heap = heapPeak;
+
+  unsigned long start = micros();
+  for (int i = 0; i < ITERATIONS; i++) {
+    stream.rewind();
+    parse(stream, result);
+  }
+  float time = (float)(micros() - start) / ITERATIONS;
+
+  printf("  %-28s %8.1f us %7zu B stack %6zu B heap%s\n", name, time, stack, heap, ok ? "" : "  parse error");
+}
+
+bool readFixture(const char *name, std::string &out) {
+  std::string path = std::string(nativeEnv("EPAPER_FIXTURES", "lib/NativeShims/fixtures")) + "/" + name;
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f) {
+    printf("no fixture at %s\n", path.c_str());
+    return false;
+  }
+  char buf[1024];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+  fclose(f);
+  return true;
+}
+
+void setup() {
+  std::string weatherBody, forecastBody;
+  if (!readFixture("weather.json", weatherBody) || !readFixture("forecast.json", forecastBody)) exit(1);
+
+  Weather weather[2];
+  printf("weather, %zu bytes\n", weatherBody.size());
+  run("ArduinoJson document", weatherBody, weatherArduinoJson, &weather[0]);
+  run("JsonExtract", weatherBody, weatherExtract, &weather[1]);
+
+  static Forecast forecast[3];
+  printf("forecast, %zu bytes\n", forecastBody.size());
+  run("ArduinoJson list document", forecastBody, forecastArduinoJsonDocument, &forecast[0]);
+  run("ArduinoJson per entry", forecastBody, forecastArduinoJson, &forecast[1]);
+  run("JsonExtract per entry", forecastBody, forecastExtract, &forecast[2]);
+
+  // both parsers have to agree for the numbers to mean anything
+  bool same = weather[0].dt == weather[1].dt && weather[0].offset == weather[1].offset &&
+              weather[0].temp == weather[1].temp && strcmp(weather[0].icon, weather[1].icon) == 0 &&
+              weather[0].sunrise == weather[1].sunrise && weather[0].sunset == weather[1].sunset;
+  for (int i = 1; i < 3; i++) {
+    same = same && forecast[i].count == forecast[0].count;
+    for (int j = 0; same && j < forecast[0].count; j++) {
+      same = forecast[i].dt[j] == forecast[0].dt[j] && forecast[i].temp[j] == forecast[0].temp[j] &&
+             strcmp(forecast[i].icon[j], forecast[0].icon[j]) == 0;
+    }
+  }
+  printf("%s\n", same ? "all parsers extracted the same values" : "the parsers disagree");
+  exit(same ? 0 : 1);
+}
+
+void loop() {}
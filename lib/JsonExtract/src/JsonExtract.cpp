@@ -0,0 +1,206 @@
+#include <JsonExtract.h>
+
+#include <ctype.h>
+
+JsonExtractor::JsonExtractor(Stream &stream, const JsonField *fields, size_t count)
+  : _stream(stream), _fields(fields), _count(count) {
+  _path[0] = '\0';
+}
+
+bool JsonExtractor::extract() {
+  _path[0] = '\0';
+  _depth = 0;
+  return value(0, true);
+}
+
+int JsonExtractor::read() {
+  if (_peeked >= 0) {
+    int c = _peeked;
+    _peeked = -1;
+    return c;
+  }
+  return _stream.read();
+}
+
+// Next character that isn't whitespace
+int JsonExtractor::next() {
+  int c;
+  do {
+    c = read();
+  } while (c == ' ' || c == '\n' || c == '\r' || c == '\t');
+  return c;
+}
+
+int JsonExtractor::peekNext() {
+  _peeked = next();
+  return _peeked;
+}
+
+// The field at _path, if any
+const JsonField *JsonExtractor::field() {
+  for (size_t i = 0; i < _count; i++) {
+    if (strcmp(_fields[i].path, _path) == 0) return &_fields[i];
+  }
+  return NULL;
+}
+
+// Whether some field is at or below _path[0, length)
+bool JsonExtractor::wanted(size_t length) {
+  for (size_t i = 0; i < _count; i++) {
+    const char *path = _fields[i].path;
+    if (strncmp(path, _path, length) == 0 &&
+        (path[length] == '\0' || path[length] == '.' || path[length] == '[')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The value at _path[0, length): `wanted` when a field may be in it,
+// otherwise it is only checked for syntax
+bool JsonExtractor::value(size_t length, bool wanted) {
+  int c = next();
+  if (c == '{' || c == '[') {
+    if (_depth == JSON_NESTING_LIMIT) return false;
+    _depth++;
+    bool ok = c == '{' ? object(length, wanted) : array(length, wanted);
+    _depth--;
+    return ok;
+  }
+
+  const JsonField *f = wanted ? field() : NULL;
+  if (c == '"') {
+    if (f && f->type == JSON_STRING) return string((char *)f->value, f->size);
+    return string(NULL, 0);
+  }
+  return scalar(c, f);
+}
+
+bool JsonExtractor::object(size_t length, bool wanted) {
+  if (peekNext() == '}') {
+    _peeked = -1;
+    return true;
+  }
+  for (;;) {
+    if (next() != '"') return false;
+
+    // the key is appended to the path when a field may be under it
+    size_t keyStart = length > 0 ? length + 1 : 0;
+    bool below = false;
+    if (wanted && keyStart < JSON_PATH_SIZE - 1) {
+      if (length > 0) _path[length] = '.';
+      if (!string(_path + keyStart, JSON_PATH_SIZE - keyStart)) return false;
+      below = !_truncated && this->wanted(strlen(_path));
+    } else if (!string(NULL, 0)) {
+      return false;
+    }
+
+    if (next() != ':') return false;
+    if (!value(below ? strlen(_path) : length, below)) return false;
+    _path[length] = '\0';
+
+    int c = next();
+    if (c == '}') return true;
+    if (c != ',') return false;
+  }
+}
+
+bool JsonExtractor::array(size_t length, bool wanted) {
+  if (peekNext() == ']') {
+    _peeked = -1;
+    return true;
+  }
+  for (int index = 0;; index++) {
+    size_t itemLength = length;
+    bool below = false;
+    if (wanted) {
+      int n = snprintf(_path + length, JSON_PATH_SIZE - length, "[%d]", index);
+      if (n > 0 && length + n < JSON_PATH_SIZE) {
+        itemLength = length + n;
+        below = this->wanted(itemLength);
+      }
+    }
+
+    if (!value(itemLength, below)) return false;
+    _path[length] = '\0';
+
+    int c = next();
+    if (c == ']') return true;
+    if (c != ',') return false;
+  }
+}
+
+// The rest of a string after its opening quote, copied to `out` when not
+// NULL, truncated to `size` (_truncated tells)
+bool JsonExtractor::string(char *out, size_t size) {
+  size_t length = 0;
+  _truncated = false;
+  for (;;) {
+    int c = read();
+    if (c < 0) return false;
+    if (c == '"') break;
+    if (c == '\\') {
+      c = read();
+      switch (c) {
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u':
+          // only ASCII is expected in the fields
+          for (int i = 0; i < 4; i++) {
+            if (read() < 0) return false;
+          }
+          c = '?';
+          break;
+        case '"': case '\\': case '/': break;
+        default: return false;
+      }
+    }
+    if (out == NULL) continue;
+    if (length + 1 < size) {
+      out[length++] = c;
+    } else {
+      _truncated = true;
+    }
+  }
+  if (out != NULL && size > 0) out[length] = '\0';
+  return true;
+}
+
+// A number or a literal starting with `c`, stored in `field` when it is a
+// number field
+bool JsonExtractor::scalar(int c, const JsonField *field) {
+  char token[JSON_NUMBER_SIZE];
+  size_t length = 0;
+  while (c >= 0 && (isalnum(c) || c == '-' || c == '+' || c == '.')) {
+    if (length + 1 >= sizeof(token)) return false;
+    token[length++] = c;
+    c = read();
+  }
+  _peeked = c;
+  token[length] = '\0';
+  if (length == 0) return false;
+
+  if (isalpha(token[0])) {
+    return strcmp(token, "true") == 0 || strcmp(token, "false") == 0 || strcmp(token, "null") == 0;
+  }
+  char *end;
+  double number = strtod(token, &end);
+  if (*end != '\0') return false;
+
+  if (field == NULL) return true;
+  switch (field->type) {
+    case JSON_INT: *(int *)field->value = (int)number; break;
+    case JSON_LONG: *(long *)field->value = (long)number; break;
+    case JSON_FLOAT: *(float *)field->value = (float)number; break;
+    case JSON_STRING: break;
+  }
+  return true;
+}
+
+bool extractJson(Stream &stream, const JsonField *fields, size_t count) {
+  JsonExtractor extractor(stream, fields, count);
+  return extractor.extract();
+}
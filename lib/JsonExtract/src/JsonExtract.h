@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Streaming extraction of a few fields of a JSON value, against a schema
+// declared as a table of paths. Values are written straight into their
+// destination as they are read: there is no document, and subtrees no field
+// is under are skipped without being copied anywhere. No heap, and a fixed
+// amount of stack per nesting level.
+//
+//   long dt;
+//   char icon[4];
+//   const JsonField fields[] = {
+//     {"dt", JSON_LONG, &dt, 0},
+//     {"weather[0].icon", JSON_STRING, icon, sizeof(icon)},
+//   };
+//   extractJson(stream, fields, 2);
+//
+// Fields missing from the input, or of another type, keep their value.
+
+#define JSON_PATH_SIZE 48      // longest path, with its NUL
+#define JSON_NUMBER_SIZE 24    // longest number or literal, with its NUL
+#define JSON_NESTING_LIMIT 10  // like ArduinoJson, bounds the recursion
+
+enum JsonFieldType {
+  JSON_INT,    // int, decimals truncated
+  JSON_LONG,   // long or unsigned long, decimals truncated
+  JSON_FLOAT,  // float
+  JSON_STRING  // char[size], truncated to fit
+};
+
+struct JsonField {
+  const char *path;  // keys separated by '.', array indexes as [n]
+  JsonFieldType type;
+  void *value;
+  size_t size;       // of a JSON_STRING destination
+};
+
+class JsonExtractor {
+  public:
+    JsonExtractor(Stream &stream, const JsonField *fields, size_t count);
+
+    // Reads one value from the stream, and nothing past it when it is an
+    // object or an array. False on a syntax error or an early end.
+    bool extract();
+
+  private:
+    int read();
+    int next();
+    int peekNext();
+    bool value(size_t length, bool wanted);
+    bool object(size_t length, bool wanted);
+    bool array(size_t length, bool wanted);
+    bool string(char *out, size_t size);
+    bool scalar(int c, const JsonField *field);
+    const JsonField *field();
+    bool wanted(size_t length);
+
+    Stream &_stream;
+    const JsonField *_fields;
+    size_t _count;
+    char _path[JSON_PATH_SIZE];
+    int _peeked = -1;
+    int _depth = 0;
+    bool _truncated = false;
+};
+
+bool extractJson(Stream &stream, const JsonField *fields, size_t count);
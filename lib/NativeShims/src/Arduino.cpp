@@ -0,0 +1,172 @@
+#include <Arduino.h>
+#include <esp_adc_cal.h>
+
+#include <chrono>
+#include <thread>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+// Bounds of the rtc_data section, provided by the linker when at least one
+// RTC_DATA_ATTR variable exists.
+extern uint8_t __start_rtc_data[] __attribute__((weak));
+extern uint8_t __stop_rtc_data[] __attribute__((weak));
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+static bool rtcRestored = false;
+static uint64_t sleepDuration = 0;
+
+const char *nativeEnv(const char *name, const char *fallback) {
+  const char *value = getenv(name);
+  return value && *value ? value : fallback;
+}
+
+static const char *rtcPath() {
+  return nativeEnv("EPAPER_RTC", ".pio/native_rtc.bin");
+}
+
+// Deep sleep keeps RTC memory, so a wake on the host starts from whatever the
+// previous run left there. Delete the file to simulate a power-on reset.
+static void restoreRtcMemory() {
+  size_t size = __stop_rtc_data - __start_rtc_data;
+  if (!__start_rtc_data || size == 0) return;
+  FILE *f = fopen(rtcPath(), "rb");
+  if (!f) return;
+  fseek(f, 0, SEEK_END);
+  // a different layout means the firmware changed: treat it as a cold boot
+  if ((size_t)ftell(f) == size) {
+    fseek(f, 0, SEEK_SET);
+    rtcRestored = fread(__start_rtc_data, 1, size, f) == size;
+  }
+  fclose(f);
+}
+
+static void saveRtcMemory() {
+  size_t size = __stop_rtc_data - __start_rtc_data;
+  if (!__start_rtc_data || size == 0) return;
+  FILE *f = fopen(rtcPath(), "wb");
+  if (!f) return;
+  fwrite(__start_rtc_data, 1, size, f);
+  fclose(f);
+}
+
+// overridden by the firmware when it has a wake stub
+void __attribute__((weak)) esp_wake_deep_sleep(void) {}
+void esp_default_wake_deep_sleep(void) {}
+
+int main() {
+  restoreRtcMemory();
+  if (rtcRestored) esp_wake_deep_sleep();
+  setup();
+  // setup() only returns on error paths, where the board would sit in loop()
+  printf("[native] setup() returned after %lu ms\n", millis());
+  return 1;
+}
+
+#if !defined(__GLIBC__) || __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+size_t strlcpy(char *dst, const char *src, size_t size) {
+  size_t len = strlen(src);
+  if (size) {
+    size_t n = len >= size ? size - 1 : len;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+#endif
+
+unsigned long millis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+static uint32_t cpuFrequency = 240;
+
+bool setCpuFrequencyMhz(uint32_t cpu_freq_mhz) {
+  cpuFrequency = cpu_freq_mhz;
+  return true;
+}
+
+uint32_t getCpuFrequencyMhz() { return cpuFrequency; }
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {}
+int digitalRead(uint8_t pin) { return LOW; }
+
+void touchAttachInterrupt(uint8_t pin, void (*userFunc)(void), uint16_t threshold) {}
+
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char *server1, const char *server2, const char *server3) {}
+
+bool getLocalTime(struct tm *info, uint32_t ms) {
+  time_t now = time(NULL);
+  gmtime_r(&now, info);
+  return true;
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return strtoul(nativeEnv("EPAPER_HEAP", "280000"), NULL, 10);
+}
+
+// no fragmentation on the host: the whole heap is one block
+uint32_t EspClass::getMaxAllocHeap() {
+  return getFreeHeap();
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us) {
+  sleepDuration = time_in_us;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_touchpad_wakeup() { return ESP_OK; }
+esp_err_t esp_sleep_enable_gpio_wakeup() { return ESP_OK; }
+
+esp_err_t esp_sleep_disable_wakeup_source(esp_sleep_source_t source) {
+  if (source == ESP_SLEEP_WAKEUP_ALL || source == ESP_SLEEP_WAKEUP_TIMER) sleepDuration = 0;
+  return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() {
+  return rtcRestored ? ESP_SLEEP_WAKEUP_TIMER : ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+// returns right away, as if the wakeup had already happened
+esp_err_t esp_light_sleep_start() { return ESP_OK; }
+
+void esp_deep_sleep_start() {
+  fflush(stdout);
+  saveRtcMemory();
+  printf("[native] awake for %lu ms, deep sleep for %llu s\n", millis(), (unsigned long long)(sleepDuration / 1000000ULL));
+  exit(0);
+}
+
+int adc1_config_width(adc_bits_width_t width_bit) { return ESP_OK; }
+int adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten) { return ESP_OK; }
+
+// raw readings are millivolts at the pin, i.e. half the battery voltage
+int adc1_get_raw(adc1_channel_t channel) {
+  return (int)(atof(nativeEnv("EPAPER_BATTERY_V", "3.9")) * 1000.0 / 2.0);
+}
+
+esp_adc_cal_value_t esp_adc_cal_characterize(adc_unit_t adc_num, adc_atten_t atten, adc_bits_width_t bit_width,
+                                             uint32_t default_vref, esp_adc_cal_characteristics_t *chars) {
+  chars->adc_num = adc_num;
+  chars->atten = atten;
+  chars->bit_width = bit_width;
+  chars->vref = default_vref;
+  return ESP_ADC_CAL_VAL_DEFAULT_VREF;
+}
+
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t adc_reading, const esp_adc_cal_characteristics_t *chars) {
+  return adc_reading;
+}
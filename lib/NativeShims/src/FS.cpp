@@ -0,0 +1,28 @@
+#include <FS.h>
+#include <LittleFS.h>
+
+#include <sys/stat.h>
+
+fs::LittleFSFS LittleFS;
+
+static std::string hostPath(const char *path) {
+  std::string root = nativeEnv("EPAPER_FS_ROOT", "data");
+  return root + (path[0] == '/' ? "" : "/") + path;
+}
+
+fs::File fs::FS::open(const char *path, const char *mode) {
+  FILE *f = fopen(hostPath(path).c_str(), mode[0] == 'r' ? "rb" : "wb");
+  return f ? File(f) : File();
+}
+
+bool fs::FS::exists(const char *path) {
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool fs::LittleFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel) {
+  struct stat st;
+  return stat(hostPath("/").c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void fs::LittleFSFS::end() {}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <memory>
+
+namespace fs {
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+// Host file behind the same copyable handle semantics as the ESP32 fs::File
+class File : public Stream {
+  public:
+    File() {}
+    explicit File(FILE *f) : _f(f, fclose) {}
+
+    operator bool() const { return (bool)_f; }
+
+    size_t write(uint8_t c) override { return _f ? fwrite(&c, 1, 1, _f.get()) : 0; }
+    size_t write(const uint8_t *buf, size_t size) override { return _f ? fwrite(buf, 1, size, _f.get()) : 0; }
+    using Print::write;
+
+    int available() override { return _f ? (int)(size() - position()) : 0; }
+    int read() override { return _f ? fgetc(_f.get()) : -1; }
+    int peek() override {
+      if (!_f) return -1;
+      int c = fgetc(_f.get());
+      if (c >= 0) ungetc(c, _f.get());
+      return c;
+    }
+    size_t read(uint8_t *buf, size_t size) { return _f ? fread(buf, 1, size, _f.get()) : 0; }
+    size_t readBytes(char *buffer, size_t length) override { return read((uint8_t *)buffer, length); }
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet) { return _f && fseek(_f.get(), pos, mode) == 0; }
+    size_t position() const { return _f ? ftell(_f.get()) : 0; }
+    size_t size() const {
+      if (!_f) return 0;
+      long pos = ftell(_f.get());
+      fseek(_f.get(), 0, SEEK_END);
+      long end = ftell(_f.get());
+      fseek(_f.get(), pos, SEEK_SET);
+      return end;
+    }
+    void close() { _f.reset(); }
+
+  private:
+    std::shared_ptr<FILE> _f;
+};
+
+// Maps the LittleFS image onto a host directory, `data/` unless
+// EPAPER_FS_ROOT says otherwise
+class FS {
+  public:
+    File open(const char *path, const char *mode = "r");
+    File open(const String &path, const char *mode = "r") { return open(path.c_str(), mode); }
+    bool exists(const char *path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+};
+
+}  // namespace fs
+
+using fs::File;
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <gfxfont.h>
+
+// Metrics only, the glyphs ship with Adafruit GFX; the shim lays out text
+// from yAdvance (see GxEPD2_3C::getTextBounds)
+const GFXfont FreeMonoBold24pt7b = {nullptr, nullptr, 0x20, 0x7E, 47};
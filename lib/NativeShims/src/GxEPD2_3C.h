@@ -0,0 +1,122 @@
+#pragma once
+
+#include <GxEPD2_GFX.h>
+
+// Paging and refresh bookkeeping of GxEPD2_3C without a panel behind it.
+// Nothing is rasterized: the shim walks the same page loop as the real
+// driver and reports each refresh with the time the GD7965 would have kept
+// BUSY low. The page buffers are there so the object has the real size.
+
+class GxEPD2_583c_Z83 {
+  public:
+    static const uint16_t WIDTH = 648;
+    static const uint16_t HEIGHT = 480;
+    static const uint16_t full_refresh_time = 16000;  // ms, from the GxEPD2 driver
+    static const uint16_t partial_refresh_time = 16000;
+
+    GxEPD2_583c_Z83(int16_t cs, int16_t dc, int16_t rst, int16_t busy) : _busy(busy) {}
+
+    void writeImage(const uint8_t *black, const uint8_t *color, int16_t x, int16_t y, int16_t w, int16_t h,
+                    bool invert = false, bool mirror_y = false, bool pgm = false) {
+      imageWrites++;
+      imageBytes += 2 * ((w + 7) / 8) * h;
+    }
+
+    // called once per refresh, for the whole time BUSY would be low
+    void setBusyCallback(void (*busyCallback)(const void *), const void *busy_callback_parameter = 0) {
+      _busy_callback = busyCallback;
+      _busy_callback_parameter = busy_callback_parameter;
+    }
+
+    void refresh(int16_t x, int16_t y, int16_t w, int16_t h) {
+      refreshes++;
+      busyTime += full_refresh_time;
+      if (_busy_callback) _busy_callback(_busy_callback_parameter);
+      printf("[native] panel refresh #%u: %dx%d at (%d,%d), %u ms busy on hardware%s\n",
+             refreshes, w, h, x, y, full_refresh_time, _busy_callback ? ", waited in the busy callback" : "");
+    }
+
+    void hibernate() {
+      printf("[native] panel hibernate: %u refreshes, %u image writes (%lu bytes), %u bitmap draws (%lu rows), %lu ms busy on hardware\n",
+             refreshes, imageWrites, imageBytes, bitmapDraws, bitmapRows, busyTime);
+    }
+
+    unsigned int refreshes = 0;
+    unsigned int imageWrites = 0;
+    unsigned long imageBytes = 0;
+    unsigned long busyTime = 0;
+    unsigned int bitmapDraws = 0;  // page buffer draws, counted here to be reported with the rest
+    unsigned long bitmapRows = 0;
+
+  private:
+    int16_t _busy;
+    void (*_busy_callback)(const void *) = NULL;
+    const void *_busy_callback_parameter = NULL;
+};
+
+template <typename GxEPD2_Type, const uint16_t page_height>
+class GxEPD2_3C : public GxEPD2_GFX {
+  public:
+    GxEPD2_Type epd2;
+
+    GxEPD2_3C(GxEPD2_Type epd2_instance) : epd2(epd2_instance) {
+      setFullWindow();
+    }
+
+    void init(uint32_t serial_diag_bitrate, bool initial, uint16_t reset_duration = 10, bool pulldown_rst_mode = false) override {
+      _initial = initial;
+    }
+
+    uint16_t pages() override { return _pages; }
+    uint16_t pageHeight() override { return page_height; }
+
+    void setFullWindow() override {
+      _pw_x = 0;
+      _pw_y = 0;
+      _pw_w = GxEPD2_Type::WIDTH;
+      _pw_h = GxEPD2_Type::HEIGHT;
+    }
+
+    void setPartialWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h) override {
+      // the controller addresses whole bytes horizontally
+      w += x % 8;
+      if (w % 8 > 0) w += 8 - w % 8;
+      x -= x % 8;
+      _pw_x = x < GxEPD2_Type::WIDTH ? x : GxEPD2_Type::WIDTH;
+      _pw_y = y < GxEPD2_Type::HEIGHT ? y : GxEPD2_Type::HEIGHT;
+      _pw_w = _pw_x + w < GxEPD2_Type::WIDTH ? w : GxEPD2_Type::WIDTH - _pw_x;
+      _pw_h = _pw_y + h < GxEPD2_Type::HEIGHT ? h : GxEPD2_Type::HEIGHT - _pw_y;
+    }
+
+    void firstPage() override {
+      _current_page = 0;
+      _pages = (_pw_h + page_height - 1) / page_height;
+    }
+
+    bool nextPage() override {
+      if (++_current_page < _pages) return true;
+      epd2.refresh(_pw_x, _pw_y, _pw_w, _pw_h);
+      return false;
+    }
+
+    void fillScreen(uint16_t color) override {}
+
+    void writeImage(const uint8_t *black, const uint8_t *color, int16_t x, int16_t y, int16_t w, int16_t h,
+                    bool invert = false, bool mirror_y = false, bool pgm = false) override {
+      epd2.writeImage(black, color, x, y, w, h, invert, mirror_y, pgm);
+    }
+
+    void drawInvertedBitmap(int16_t x, int16_t y, const uint8_t bitmap[], int16_t w, int16_t h, uint16_t color) override {
+      epd2.bitmapDraws++;
+      epd2.bitmapRows += h;
+    }
+
+    void hibernate() override { epd2.hibernate(); }
+
+  private:
+    bool _initial = true;
+    uint16_t _pw_x, _pw_y, _pw_w, _pw_h;
+    uint16_t _current_page = 0, _pages = 1;
+    uint8_t _black_buffer[(uint32_t(GxEPD2_Type::WIDTH) * uint32_t(page_height)) / 8];
+    uint8_t _color_buffer[(uint32_t(GxEPD2_Type::WIDTH) * uint32_t(page_height)) / 8];
+};
@@ -0,0 +1,4 @@
+#pragma once
+
+// main.h includes both drivers; only the 3-color one is used
+#include "GxEPD2_3C.h"
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <Arduino.h>
+#include <gfxfont.h>
+
+// The GxEPD2_GFX base class (ENABLE_GxEPD2_GFX), holding the Adafruit_GFX
+// text state. Nothing is rasterized: text is only measured.
+
+#define GxEPD_BLACK 0x0000
+#define GxEPD_WHITE 0xFFFF
+#define GxEPD_RED   0xF800
+
+class GxEPD2_GFX : public Print {
+  public:
+    virtual ~GxEPD2_GFX() {}
+
+    virtual void init(uint32_t serial_diag_bitrate, bool initial, uint16_t reset_duration = 10, bool pulldown_rst_mode = false) = 0;
+    virtual uint16_t pages() = 0;
+    virtual uint16_t pageHeight() = 0;
+    virtual void setFullWindow() = 0;
+    virtual void setPartialWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h) = 0;
+    virtual void firstPage() = 0;
+    virtual bool nextPage() = 0;
+    virtual void fillScreen(uint16_t color) = 0;
+    virtual void writeImage(const uint8_t *black, const uint8_t *color, int16_t x, int16_t y, int16_t w, int16_t h,
+                            bool invert = false, bool mirror_y = false, bool pgm = false) = 0;
+    virtual void drawInvertedBitmap(int16_t x, int16_t y, const uint8_t bitmap[], int16_t w, int16_t h, uint16_t color) = 0;
+    virtual void hibernate() = 0;
+
+    virtual void drawPixel(int16_t x, int16_t y, uint16_t color) {}
+    void setRotation(uint8_t r) { _rotation = r & 3; }
+    void setTextColor(uint16_t c) { _textcolor = c; }
+    void setFont(const GFXfont *f) { _gfxFont = f; }
+    void setCursor(int16_t x, int16_t y) { _cursor_x = x; _cursor_y = y; }
+
+    void getTextBounds(const char *str, int16_t x, int16_t y, int16_t *x1, int16_t *y1, uint16_t *w, uint16_t *h) {
+      int16_t minx = 0x7FFF, miny = 0x7FFF, maxx = -1, maxy = -1;
+      for (; *str; str++) {
+        int16_t gx, gy, gw, gh, xa;
+        glyphMetrics(*str, &gx, &gy, &gw, &gh, &xa);
+        if (gw > 0 && gh > 0) {
+          if (x + gx < minx) minx = x + gx;
+          if (y + gy < miny) miny = y + gy;
+          if (x + gx + gw - 1 > maxx) maxx = x + gx + gw - 1;
+          if (y + gy + gh - 1 > maxy) maxy = y + gy + gh - 1;
+        }
+        x += xa;
+      }
+      *x1 = maxx >= minx ? minx : x;
+      *y1 = maxy >= miny ? miny : y;
+      *w = maxx >= minx ? maxx - minx + 1 : 0;
+      *h = maxy >= miny ? maxy - miny + 1 : 0;
+    }
+
+    size_t write(uint8_t c) override {
+      int16_t gx, gy, gw, gh, xa;
+      glyphMetrics(c, &gx, &gy, &gw, &gh, &xa);
+      _cursor_x += xa;
+      return 1;
+    }
+    using Print::write;
+
+  protected:
+    // Glyph box relative to the cursor. Fonts without glyph tables (the
+    // Adafruit ones, see Fonts/) are FreeMono: 0.6 em advance and cap height.
+    void glyphMetrics(uint8_t c, int16_t *gx, int16_t *gy, int16_t *gw, int16_t *gh, int16_t *xa) {
+      *gx = *gy = *gw = *gh = *xa = 0;
+      if (!_gfxFont || c < _gfxFont->first || c > _gfxFont->last) return;
+      if (_gfxFont->glyph) {
+        const GFXglyph *glyph = &_gfxFont->glyph[c - _gfxFont->first];
+        *gx = glyph->xOffset;
+        *gy = glyph->yOffset;
+        *gw = glyph->width;
+        *gh = glyph->height;
+        *xa = glyph->xAdvance;
+      } else {
+        *xa = _gfxFont->yAdvance * 3 / 5;
+        if (c != ' ') {
+          *gw = *xa;
+          *gh = *xa;
+          *gy = -*gh;
+        }
+      }
+    }
+
+    const GFXfont *_gfxFont = nullptr;
+    int16_t _cursor_x = 0, _cursor_y = 0;
+    uint16_t _textcolor = GxEPD_BLACK;
+    uint8_t _rotation = 0;
+};
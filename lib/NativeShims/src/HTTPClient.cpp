@@ -0,0 +1,235 @@
+#include <HTTPClient.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <string>
+
+static bool readFile(const std::string &path, std::string &out) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f) return false;
+  char buf[1024];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+  fclose(f);
+  return true;
+}
+
+// Index of the bracket closing the object or array opened at `open`
+static size_t matching(const std::string &body, size_t open) {
+  int depth = 0;
+  bool inString = false;
+  for (size_t i = open; i < body.size(); i++) {
+    char c = body[i];
+    if (inString) {
+      if (c == '\\') i++;
+      else if (c == '"') inString = false;
+    } else if (c == '"') {
+      inString = true;
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if ((c == '}' || c == ']') && --depth == 0) {
+      return i;
+    }
+  }
+  return std::string::npos;
+}
+
+// The recorded forecast holds the full 40 slots; cut it down to what `cnt=`
+// asked for so the payload size matches what the API would send.
+static void truncateList(std::string &body, int cnt) {
+  size_t open = body.find("\"list\":[");
+  if (open == std::string::npos) return;
+  open += 7;
+  size_t close = matching(body, open);
+  size_t pos = open + 1;
+  for (int entries = 0; entries < cnt; entries++) {
+    pos = body.find('{', pos);
+    if (pos == std::string::npos || pos > close) return;
+    pos = matching(body, pos) + 1;
+  }
+  body.erase(pos, close - pos);
+}
+
+// Transfer-Encoding: chunked, in pieces of the size a TLS record carries
+static std::string chunked(const std::string &body) {
+  const size_t chunkSize = 1370;
+  std::string out;
+  char line[16];
+  for (size_t pos = 0; pos < body.size(); pos += chunkSize) {
+    size_t n = std::min(chunkSize, body.size() - pos);
+    snprintf(line, sizeof(line), "%zx\r\n", n);
+    out += line;
+    out.append(body, pos, n);
+    out += "\r\n";
+  }
+  return out + "0\r\n\r\n";
+}
+
+static std::string gzip(const std::string &body) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&stream, body.size()) + 32, '\0');
+  stream.next_in = (Bytef *)body.data();
+  stream.avail_in = body.size();
+  stream.next_out = (Bytef *)&out[0];
+  stream.avail_out = out.size();
+  deflate(&stream, Z_FINISH);
+  out.resize(stream.total_out);
+  deflateEnd(&stream);
+  return out;
+}
+
+HTTPClient::~HTTPClient() {
+  if (_client) _client->stop();
+}
+
+bool HTTPClient::begin(WiFiClient &client, const String &url) {
+  _client = &client;
+  _url = url;
+  _size = -1;
+  _headers.clear();
+  return true;
+}
+
+// Unread bytes are dropped either way, the connection stays up for reuse
+void HTTPClient::end() {
+  if (!_client) return;
+  int unread = _client->available();
+  if (unread > 0) printf("[native] %d unread response bytes discarded\n", unread);
+  if (_reuse && _client->connected()) {
+    while (_client->read() >= 0) {}
+  } else {
+    _client->stop();
+  }
+}
+
+// Like the ESP32 HTTPClient, only replaces a header added before, never one
+// it sends itself
+void HTTPClient::addHeader(const String &name, const String &value, bool first, bool replace) {
+  for (size_t i = 0; replace && i < _headers.size(); i++) {
+    if (strcasecmp(_headers[i].first.c_str(), name.c_str()) == 0) {
+      _headers[i].second = value.c_str();
+      return;
+    }
+  }
+  std::pair<std::string, std::string> header(name.c_str(), value.c_str());
+  _headers.insert(first ? _headers.begin() : _headers.end(), header);
+}
+
+// Whether the first Accept-Encoding of the request takes gzip
+bool HTTPClient::acceptsGzip(const char *endpoint) {
+  std::vector<std::string> values;
+  if (!_useHTTP10) values.push_back(_acceptEncoding);
+  for (size_t i = 0; i < _headers.size(); i++) {
+    if (strcasecmp(_headers[i].first.c_str(), "Accept-Encoding") == 0) values.push_back(_headers[i].second);
+  }
+  if (values.empty()) return false;
+  if (values.size() > 1) {
+    printf("[native] GET %s: %zu Accept-Encoding headers, the first one counts\n", endpoint, values.size());
+  }
+  const std::string &value = values[0];
+  size_t gzip = value.find("gzip");
+  if (gzip == std::string::npos) return false;
+  size_t q = gzip + 4;
+  return value.compare(q, 3, ";q=") != 0 || atof(value.c_str() + q + 3) > 0;
+}
+
+void HTTPClient::collectHeaders(const char *headerKeys[], const size_t headerKeysCount) {
+  _headerKeys.assign(headerKeys, headerKeys + headerKeysCount);
+  _headerValues.assign(headerKeysCount, "");
+}
+
+String HTTPClient::header(const char *name) {
+  for (size_t i = 0; i < _headerKeys.size(); i++) {
+    if (strcasecmp(_headerKeys[i].c_str(), name) == 0) return String(_headerValues[i]);
+  }
+  return String();
+}
+
+int HTTPClient::GET() {
+  std::string url = _url.c_str();
+  size_t hostStart = url.find("://");
+  if (!_client || hostStart == std::string::npos) return HTTPC_ERROR_CONNECTION_REFUSED;
+  hostStart += 3;
+  std::string host = url.substr(hostStart, url.find_first_of(":/", hostStart) - hostStart);
+  uint16_t port = url.compare(0, 6, "https:") == 0 ? 443 : 80;
+  size_t portStart = hostStart + host.size();
+  if (url[portStart] == ':') port = atoi(url.c_str() + portStart + 1);
+
+  // the API, or the digest proxy
+  std::string endpoint;
+  std::string file;
+  size_t start = url.find("/data/2.5/");
+  if (start != std::string::npos) {
+    start += 10;
+    endpoint = url.substr(start, url.find('?', start) - start);
+    file = endpoint + ".json";
+  } else if (url.find("/state?") != std::string::npos) {
+    endpoint = "state";
+    file = "state.bin";
+  } else {
+    return HTTPC_ERROR_CONNECTION_REFUSED;
+  }
+
+  std::string body;
+  std::string path = std::string(nativeEnv("EPAPER_FIXTURES", "lib/NativeShims/fixtures")) + "/" + file;
+  if (!readFile(path, body)) {
+    printf("[native] GET %s: no fixture at %s\n", endpoint.c_str(), path.c_str());
+    return HTTP_CODE_NOT_FOUND;
+  }
+
+  size_t cnt = url.find("&cnt=");
+  if (cnt != std::string::npos) {
+    int n = atoi(url.c_str() + cnt + 5);
+    truncateList(body, n);
+    size_t field = body.find("\"cnt\":");
+    if (field != std::string::npos) {
+      size_t end = body.find_first_of(",}", field);
+      body.replace(field, end - field, "\"cnt\":" + std::to_string(n));
+    }
+  }
+
+  if (_client->connected()) {
+    printf("[native] GET %s: reusing the connection\n", endpoint.c_str());
+  } else {
+    _client->connect(host.c_str(), port);
+  }
+  for (size_t i = 0; i < _headerValues.size(); i++) _headerValues[i] = "";
+  for (size_t i = 0; i < _headerKeys.size(); i++) {
+    if (strcasecmp(_headerKeys[i].c_str(), "Date") == 0) {
+      char date[32];
+      time_t now = time(NULL);
+      struct tm tm;
+      strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&now, &tm));
+      _headerValues[i] = date;
+    }
+  }
+  size_t length = body.size();
+  bool gzipped = acceptsGzip(endpoint.c_str());
+  if (gzipped) {
+    body = gzip(body);
+    for (size_t i = 0; i < _headerKeys.size(); i++) {
+      if (strcasecmp(_headerKeys[i].c_str(), "Content-Encoding") == 0) _headerValues[i] = "gzip";
+    }
+  }
+  delay(strtoul(nativeEnv("EPAPER_HTTP_DELAY", "0"), NULL, 10));
+  if (_useHTTP10) {
+    _size = length;
+    _client->receive(body);
+  } else {
+    _size = -1;
+    for (size_t i = 0; i < _headerKeys.size(); i++) {
+      if (strcasecmp(_headerKeys[i].c_str(), "Transfer-Encoding") == 0) _headerValues[i] = "chunked";
+    }
+    _client->receive(chunked(body));
+  }
+  if (gzipped) {
+    printf("[native] GET %s: 200, %zu bytes gzipped from %zu%s\n", endpoint.c_str(), body.size(), length,
+           _useHTTP10 ? "" : ", chunked");
+  } else {
+    printf("[native] GET %s: 200, %zu bytes%s\n", endpoint.c_str(), length, _useHTTP10 ? "" : " chunked");
+  }
+  return HTTP_CODE_OK;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <WiFiClient.h>
+
+#include <vector>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+
+typedef enum {
+  HTTP_CODE_OK = 200,
+  HTTP_CODE_NOT_FOUND = 404,
+} t_http_codes;
+
+// Answers GET requests from recorded payloads: .../data/2.5/<endpoint>?...
+// is served from <fixtures>/<endpoint>.json and the digest proxy's
+// .../state?... from <fixtures>/state.bin, where <fixtures> is
+// EPAPER_FIXTURES or lib/NativeShims/fixtures. HTTP/1.1 responses come
+// chunked like the API sends them, and the connection is kept open when
+// reuse is on, as with the ESP32 HTTPClient. The request headers are those
+// the ESP32 HTTPClient would send, its own Accept-Encoding first for HTTP/1.1,
+// and the body is gzipped when the first Accept-Encoding asks for it, the one
+// nginx reads for the API.
+class HTTPClient {
+  public:
+    ~HTTPClient();
+    bool begin(WiFiClient &client, const String &url);
+    void end();
+    void useHTTP10(bool usehttp10 = true) {
+      _useHTTP10 = usehttp10;
+      _reuse = !usehttp10;
+    }
+    void setReuse(bool reuse) { _reuse = reuse; }
+    void setConnectTimeout(int32_t connectTimeout) { _connectTimeout = connectTimeout; }
+    void setTimeout(uint16_t timeout) { _tcpTimeout = timeout; }
+    void setAcceptEncoding(const String &acceptEncoding) { _acceptEncoding = acceptEncoding.c_str(); }
+    void addHeader(const String &name, const String &value, bool first = false, bool replace = true);
+    void collectHeaders(const char *headerKeys[], const size_t headerKeysCount);
+    String header(const char *name);
+    int GET();
+    int getSize() { return _size; }
+    WiFiClient &getStream() { return *_client; }
+
+  private:
+    bool acceptsGzip(const char *endpoint);
+
+    WiFiClient *_client = nullptr;
+    String _url;
+    bool _useHTTP10 = false;
+    bool _reuse = true;
+    std::string _acceptEncoding = "identity;q=1,chunked;q=0.1,*;q=0";
+    std::vector<std::pair<std::string, std::string>> _headers;  // added, until the next begin()
+    int _size = -1;
+    int32_t _connectTimeout = 5000;  // stored only, fixtures answer at once
+    uint16_t _tcpTimeout = 5000;
+    std::vector<std::string> _headerKeys;
+    std::vector<std::string> _headerValues;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print {
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      size_t n = 0;
+      while (size--) {
+        n += write(*buffer++);
+      }
+      return n;
+    }
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+      char buf[256];
+      va_list args;
+      va_start(args, format);
+      int len = vsnprintf(buf, sizeof(buf), format, args);
+      va_end(args);
+      if (len < 0) return 0;
+      return write((const uint8_t *)buf, (size_t)len < sizeof(buf) ? len : sizeof(buf) - 1);
+    }
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write(str.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long n, int base = DEC) { return base == DEC ? printf("%ld", n) : printNumber((unsigned long)n, base); }
+    size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long long n, int base = DEC) { return base == DEC ? printf("%lld", n) : printNumber((unsigned long)n, base); }
+    size_t print(unsigned long long n, int base = DEC) { return base == DEC ? printf("%llu", n) : printNumber((unsigned long)n, base); }
+    size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+    size_t print(const struct tm *timeinfo, const char *format = NULL) {
+      char buf[64];
+      size_t len = strftime(buf, sizeof(buf), format ? format : "%c", timeinfo);
+      return write((const uint8_t *)buf, len);
+    }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T &value) { return print(value) + println(); }
+    template <typename T> size_t println(const T &value, int modifier) { return print(value, modifier) + println(); }
+    size_t println(const struct tm *timeinfo, const char *format) { return print(timeinfo, format) + println(); }
+
+  private:
+    size_t printNumber(unsigned long n, int base) {
+      char buf[8 * sizeof(long) + 1];
+      char *str = &buf[sizeof(buf) - 1];
+      *str = '\0';
+      if (base < 2) base = 10;
+      do {
+        char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+      } while (n);
+      return write(str);
+    }
+};
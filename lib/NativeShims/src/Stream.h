@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string.h>
+
+#include "Print.h"
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+
+    virtual size_t readBytes(char *buffer, size_t length) {
+      size_t count = 0;
+      while (count < length) {
+        int c = read();
+        if (c < 0) break;
+        *buffer++ = (char)c;
+        count++;
+      }
+      return count;
+    }
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+    bool find(const char *target) { return findUntil(target, nullptr); }
+
+    // Reads until `target` (true) or `terminator` or the end (false)
+    bool findUntil(const char *target, const char *terminator) {
+      size_t targetLength = strlen(target);
+      size_t termLength = terminator ? strlen(terminator) : 0;
+      size_t index = 0;
+      size_t termIndex = 0;
+      int c;
+      while ((c = read()) >= 0) {
+        if (c == target[index]) {
+          if (++index == targetLength) return true;
+        } else {
+          index = c == target[0] ? 1 : 0;
+        }
+        if (termLength > 0) {
+          if (c == terminator[termIndex]) {
+            if (++termIndex == termLength) return false;
+          } else {
+            termIndex = c == terminator[0] ? 1 : 0;
+          }
+        }
+      }
+      return false;
+    }
+
+  protected:
+    unsigned long _timeout = 1000;
+};
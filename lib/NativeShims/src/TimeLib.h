@@ -0,0 +1,24 @@
+#pragma once
+
+#include <time.h>
+
+// The calendar helpers of paulstoffregen/Time, computed with gmtime_r; the
+// station always passes times that are already shifted to local time.
+
+static inline struct tm timeLibBreak(time_t t) {
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  return tm;
+}
+
+inline int second(time_t t) { return timeLibBreak(t).tm_sec; }
+inline int minute(time_t t) { return timeLibBreak(t).tm_min; }
+inline int hour(time_t t) { return timeLibBreak(t).tm_hour; }
+inline int day(time_t t) { return timeLibBreak(t).tm_mday; }
+inline int weekday(time_t t) { return timeLibBreak(t).tm_wday + 1; }  // Sunday is day 1
+inline int month(time_t t) { return timeLibBreak(t).tm_mon + 1; }     // Jan is month 1
+inline int year(time_t t) { return timeLibBreak(t).tm_year + 1900; }
+
+#define SECS_PER_MIN  ((time_t)(60UL))
+#define SECS_PER_HOUR ((time_t)(3600UL))
+#define SECS_PER_DAY  ((time_t)(SECS_PER_HOUR * 24UL))
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string.h>
+#include <strings.h>
+#include <string>
+
+// Just enough of Arduino's String for `String("/") + filename`
+class String {
+  public:
+    String() {}
+    String(const char *str) : _str(str ? str : "") {}
+    String(const std::string &str) : _str(str) {}
+
+    const char *c_str() const { return _str.c_str(); }
+    unsigned int length() const { return _str.length(); }
+    bool equalsIgnoreCase(const char *rhs) const { return strcasecmp(_str.c_str(), rhs) == 0; }
+    bool startsWith(const char *prefix) const { return _str.compare(0, strlen(prefix), prefix) == 0; }
+    int indexOf(char c, unsigned int from = 0) const {
+      size_t pos = _str.find(c, from);
+      return pos == std::string::npos ? -1 : (int)pos;
+    }
+    String substring(unsigned int from, unsigned int to) const { return String(_str.substr(from, to - from)); }
+    String substring(unsigned int from) const { return String(_str.substr(from)); }
+
+    String &operator+=(const String &rhs) { _str += rhs._str; return *this; }
+    String &operator+=(const char *rhs) { _str += rhs; return *this; }
+    String &operator+=(char c) { _str += c; return *this; }
+    bool operator==(const char *rhs) const { return _str == rhs; }
+    bool operator==(const String &rhs) const { return _str == rhs._str; }
+
+    friend String operator+(const String &lhs, const String &rhs) { return String(lhs._str + rhs._str); }
+    friend String operator+(const String &lhs, const char *rhs) { return String(lhs._str + rhs); }
+
+  private:
+    std::string _str;
+};
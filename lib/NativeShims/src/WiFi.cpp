@@ -0,0 +1,60 @@
+#include <WiFi.h>
+
+WiFiClass WiFi;
+const IPAddress INADDR_NONE((uint32_t)0);
+
+int WiFiClient::connect(const char *host, uint16_t port) {
+  ::printf("[native] connect to %s:%u\n", host, port); // not Print::printf
+  _connected = true;
+  return 1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size) {
+  size_t n = _rx.size() - _pos;
+  if (n > size) n = size;
+  memcpy(buf, _rx.data() + _pos, n);
+  _pos += n;
+  return n;
+}
+
+void WiFiClient::stop() {
+  _connected = false;
+  _rx.clear();
+  _pos = 0;
+}
+
+void WiFiClient::receive(const std::string &bytes) {
+  _rx.erase(0, _pos);
+  _pos = 0;
+  _rx += bytes;
+}
+
+bool WiFiClass::mode(wifi_mode_t mode) {
+  if (mode == WIFI_OFF) _status = WL_DISCONNECTED;
+  return true;
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect) {
+  bool direct = channel == this->channel() && bssid && memcmp(bssid, _bssid, sizeof(_bssid)) == 0;
+  if (strcmp(nativeEnv("EPAPER_WIFI", "up"), "down") == 0) {
+    printf("[native] wifi: '%s' not found\n", ssid);
+    _status = WL_NO_SSID_AVAIL;
+    return _status;
+  }
+  if (!_staticIp) _ip = IPAddress(192, 168, 1, 50);
+  printf("[native] wifi: associated with '%s' (%s, %s)\n", ssid, direct ? "no scan" : "scan",
+         _staticIp ? "static IP" : "DHCP");
+  _status = WL_CONNECTED;
+  return _status;
+}
+
+bool WiFiClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  _staticIp = (uint32_t)local_ip != 0;
+  _ip = local_ip;
+  return true;
+}
+
+bool WiFiClass::disconnect(bool wifioff) {
+  _status = WL_DISCONNECTED;
+  return true;
+}
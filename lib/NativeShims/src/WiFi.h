@@ -0,0 +1,80 @@
+#pragma once
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+#include <string>
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6,
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } wifi_mode_t;
+
+class Client : public Stream {
+  public:
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual int read(uint8_t *buf, size_t size) = 0;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    using Stream::read;
+};
+
+// The host has no sockets: HTTPClient loads a recorded response into the
+// client, which then replays it to whoever reads the stream.
+class WiFiClient : public Client {
+  public:
+    int connect(const char *host, uint16_t port) override;
+    size_t write(uint8_t c) override { return 1; }
+    size_t write(const uint8_t *buf, size_t size) override { return size; }
+    using Print::write;
+    int available() override { return _rx.size() - _pos; }
+    int read() override { return _pos < _rx.size() ? (uint8_t)_rx[_pos++] : -1; }
+    int read(uint8_t *buf, size_t size) override;
+    int peek() override { return _pos < _rx.size() ? (uint8_t)_rx[_pos] : -1; }
+    size_t readBytes(char *buffer, size_t length) override { return read((uint8_t *)buffer, length); }
+    void stop() override;
+    uint8_t connected() override { return _connected || available() > 0; }
+
+    // host only: queue bytes as if they had arrived from the peer
+    void receive(const std::string &bytes);
+
+  protected:
+    bool _connected = false;
+    std::string _rx;
+    size_t _pos = 0;
+};
+
+// Associates at once. The network has one access point on channel 6 and a
+// DHCP server handing out 192.168.1.50.
+class WiFiClass {
+  public:
+    bool mode(wifi_mode_t mode);
+    wl_status_t begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0,
+                      const uint8_t *bssid = NULL, bool connect = true);
+    bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet,
+                IPAddress dns1 = (uint32_t)0, IPAddress dns2 = (uint32_t)0);
+    wl_status_t status() { return _status; }
+    bool disconnect(bool wifioff = false);
+
+    uint8_t *BSSID() { return _bssid; }
+    int32_t channel() { return 6; }
+    IPAddress localIP() { return _ip; }
+    IPAddress gatewayIP() { return IPAddress(192, 168, 1, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+    IPAddress dnsIP(uint8_t dns_no = 0) { return IPAddress(192, 168, 1, 1); }
+
+  private:
+    wl_status_t _status = WL_DISCONNECTED;
+    uint8_t _bssid[6] = {0x24, 0x0a, 0xc4, 0x12, 0x34, 0x56};
+    IPAddress _ip;
+    bool _staticIp = false;
+};
+
+extern WiFiClass WiFi;
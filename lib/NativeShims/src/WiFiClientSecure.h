@@ -0,0 +1,10 @@
+#pragma once
+
+#include <WiFi.h>
+
+// TLS is not modelled: the certificate bundle is accepted and ignored
+class WiFiClientSecure : public WiFiClient {
+  public:
+    void setCACertBundle(const uint8_t *bundle) { (void)bundle; }
+    void setInsecure() {}
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+// Host build of the GPIO wakeup calls of the ESP-IDF driver: nothing to arm.
+
+#include <esp_sleep.h>
+
+typedef int gpio_num_t;
+
+typedef enum {
+  GPIO_INTR_DISABLE,
+  GPIO_INTR_POSEDGE,
+  GPIO_INTR_NEGEDGE,
+  GPIO_INTR_ANYEDGE,
+  GPIO_INTR_LOW_LEVEL,
+  GPIO_INTR_HIGH_LEVEL,
+} gpio_int_type_t;
+
+inline esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type) { return ESP_OK; }
+inline esp_err_t gpio_wakeup_disable(gpio_num_t gpio_num) { return ESP_OK; }
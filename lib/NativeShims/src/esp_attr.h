@@ -0,0 +1,9 @@
+#pragma once
+
+// RTC slow memory survives deep sleep on the ESP32. On the host, variables
+// tagged with it are gathered in one section that the shim saves to disk in
+// esp_deep_sleep_start() and restores before setup() (see Arduino.cpp).
+#define RTC_DATA_ATTR __attribute__((section("rtc_data")))
+#define RTC_NOINIT_ATTR RTC_DATA_ATTR
+#define IRAM_ATTR
+#define RTC_IRAM_ATTR
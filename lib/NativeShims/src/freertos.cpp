@@ -0,0 +1,34 @@
+#include <Arduino.h>
+#include <freertos/task.h>
+
+#include <chrono>
+#include <thread>
+
+// core of the calling thread, the setup/loop task runs on core 1
+static thread_local BaseType_t currentCore = 1;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *created, BaseType_t core) {
+  (void)stackDepth;
+  (void)priority;
+  printf("[native] task %s on core %d\n", name, core);
+  std::thread thread([task, parameter, core]() {
+    currentCore = core;
+    task(parameter);
+  });
+  if (created) *created = NULL;
+  thread.detach();
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  (void)task;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+BaseType_t xPortGetCoreID() {
+  return currentCore;
+}
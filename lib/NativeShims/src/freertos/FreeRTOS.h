@@ -0,0 +1,18 @@
+#pragma once
+
+// Host build of the FreeRTOS types used by the station. A tick is a
+// millisecond, as with CONFIG_FREERTOS_HZ=1000.
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
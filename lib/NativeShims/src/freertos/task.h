@@ -0,0 +1,16 @@
+#pragma once
+
+// Host build of the FreeRTOS tasks: a task is a detached thread, the core it
+// is pinned to is only remembered. vTaskDelete(NULL) doesn't end the thread,
+// the task function returning right after it does.
+
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackDepth, void *parameter,
+                                   UBaseType_t priority, TaskHandle_t *created, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xPortGetCoreID();
@@ -0,0 +1,30 @@
+#include <esp32/rom/miniz.h>
+
+#include <string.h>
+
+// zlib keeps its own window, so the output can go anywhere in the caller's
+// dictionary. The zlib state isn't freed: the ROM API has no call for it,
+// and a host run is a single wake.
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const mz_uint8 *pIn_buf_next, size_t *pIn_buf_size,
+                              mz_uint8 *pOut_buf_start, mz_uint8 *pOut_buf_next, size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags) {
+  if (r->m_state == 0) {
+    memset(&r->stream, 0, sizeof(r->stream));
+    int windowBits = (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? MAX_WBITS : -MAX_WBITS;
+    if (inflateInit2(&r->stream, windowBits) != Z_OK) return TINFL_STATUS_FAILED;
+    r->m_state = 1;
+  }
+
+  r->stream.next_in = (Bytef *)pIn_buf_next;
+  r->stream.avail_in = *pIn_buf_size;
+  r->stream.next_out = pOut_buf_next;
+  r->stream.avail_out = *pOut_buf_size;
+  int result = inflate(&r->stream, Z_NO_FLUSH);
+  *pIn_buf_size -= r->stream.avail_in;
+  *pOut_buf_size -= r->stream.avail_out;
+
+  if (result == Z_STREAM_END) return TINFL_STATUS_DONE;
+  if (result != Z_OK && result != Z_BUF_ERROR) return TINFL_STATUS_FAILED;
+  if (r->stream.avail_out == 0) return TINFL_STATUS_HAS_MORE_OUTPUT;
+  return (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) ? TINFL_STATUS_NEEDS_MORE_INPUT : TINFL_STATUS_FAILED;
+}
@@ -3,27 +3,104 @@
 #define FileClass fs::File
 
 #define uS_TO_S_FACTOR 1000000ULL   // Conversion factor from microseconds to seconds
-#define TIME_TO_SLEEP  3600         // wake-up once per hour
+#define REFRESH_INTERVAL 3600       // longest sleep on a good battery, see scheduleWake()
+#define RETRY_SLEEP    60           // first retry after a failed refresh, doubled on each failure
+#define MIN_SLEEP      300          // events closer than that wait for the next wake
+#define PUBLISH_DELAY  600          // s after the hour or a slot for OpenWeather to have the new data
+#define DATE_MARGIN    60           // s after midnight, for the clock being early
+#define FORECAST_SLOT  10800        // s between forecast slots, on multiples of it in UTC
 
 #define TOUCH_THRESHOLD 40 /* Greater the value, more the sensitivity */
 touch_pad_t touchPin;
 
 extern const uint8_t rootca_crt_bundle_start[] asm("_binary_data_cert_x509_crt_bundle_bin_start");
+extern const uint8_t icons_atlas_start[] asm("_binary_data_icons_atlas_bin_start");
 
+const char* openWeatherHost = "api.openweathermap.org";
 const char* openWeatherApi = "https://api.openweathermap.org/data/2.5/%s?q=%s&units=metric&APPID=%s%s";
 const char* weatherEndpoint = "weather";
 const char* forecastEndpoint = "forecast";
 
-State state;
+State state;  // filled by the network task, read by setup() as it publishes parts
+std::atomic<uint8_t> stateProgress(STATE_PENDING);
 
-Display display(GxEPD2_583c_Z83(16, 4, 22, 17)); // GDEW0583Z83 648x480, GD7965
+Display *display = NULL; // GDEW0583Z83 648x480, GD7965, created by initDisplay()
+Panel (*deleteDisplay)(Display *) = NULL;  // for the page height it was created with
+DisplayList frame;
+uint8_t framedRegions = 0;  // regions recorded in `frame`
 
 int ledPin = D9;
 
 float batteryVoltage;
 
-RTC_DATA_ATTR unsigned long lastUpdate = 0;
-int dayChangedCache = -1;
+// settings.json is only read on a cold boot
+RTC_DATA_ATTR Settings cachedSettings;
+RTC_DATA_ATTR bool settingsCached = false;
+bool fsMounted = false;
+
+// content hash of each region as last shown on the panel, see regionHash()
+RTC_DATA_ATTR uint32_t regionHashes[REGION_COUNT];
+
+RTC_DATA_ATTR WifiCache wifiCache;
+RTC_DATA_ATTR uint8_t failedRefreshes = 0;
+RTC_DATA_ATTR time_t lastNtpSync = 0;
+RTC_DATA_ATTR ForecastCache forecastCache;
+RTC_DATA_ATTR WakeStubPlan stubPlan;
+
+#ifdef ARDUINO_ARCH_ESP32
+RTC_DATA_ATTR TlsSession tlsSession;
+#endif
+
+RTC_DATA_ATTR WakeTrace wakeTraces[WAKE_TRACE_COUNT];
+RTC_DATA_ATTR uint32_t wakeCount = 0;
+WakeTrace currentTrace;
+uint32_t spanStarts[STAGE_COUNT];
+bool pageSpanOpen = false;  // in the page loop of composeFrame(), see busyBegin()
+
+const char *const stageNames[STAGE_COUNT] = {
+  "readBattery",
+  "LittleFS.begin",
+  "loadSettings",
+  "connectToWifi",
+  "TLS handshake",
+  "refreshWeather",
+  "refreshForecast",
+  "refreshDigest",
+  "setClock",
+  "display.init",
+  "drawDate",
+  "drawSunset",
+  "drawWeather",
+  "drawForecast",
+  "drawLastUpdate",
+  "drawBattery",
+  "page render/write",
+  "panel busy",
+  "display.hibernate"
+};
+
+const uint16_t cpuSpeedMhz[CPU_SPEED_COUNT] = {80, 240};
+uint32_t runningStages = 0;    // bit per Stage
+CpuSpeed cpuSpeed = CPU_FAST;
+uint32_t cpuSpeedSince = 0;    // micros() of the last change
+std::mutex governorLock;       // spans begin and end on both cores
+
+void drawDate();
+void drawSunset();
+void drawWeather();
+void drawForecast();
+void drawLastUpdate();
+void drawBattery();
+
+// indexed by RegionId
+const Region regions[REGION_COUNT] = {
+  {0, 0, 240, 280, STAGE_DISPLAY_DATE, drawDate},
+  {10, 330, 200, 100, STAGE_DISPLAY_SUNSET, drawSunset},
+  {240, 30, 210, 410, STAGE_DISPLAY_WEATHER, drawWeather},
+  {470, 10, 648 - 470 - 1, 430, STAGE_DISPLAY_FORECAST, drawForecast},
+  {460, 450, 100, 30, STAGE_DISPLAY_LAST_UPDATE, drawLastUpdate},
+  {560, 450, 88, 30, STAGE_DISPLAY_BATTERY, drawBattery},
+};
 
 void updateInProgress() {
   digitalWrite(ledPin, HIGH);
@@ -37,19 +114,231 @@ void touchCallback(){
   //placeholder callback function
 }
 
+// Seconds until the next wake: the one scheduleWake() picks, or after
+// failed refreshes a retry delay doubling with each failure up to the
+// refresh interval. Twice that on a low battery, so what is left isn't
+// spent on a network that is down.
+uint32_t sleepTime() {
+  if (failedRefreshes == 0) return scheduleWake();
+  uint32_t seconds = (uint32_t)RETRY_SLEEP << min(failedRefreshes - 1, 6);
+  if (batteryVoltage < LOW_BATTERY_VOLTAGE) seconds *= 2;
+  return min(seconds, (uint32_t)REFRESH_INTERVAL);
+}
+
+// Makes `at` the next wake when it is the earliest so far and not too close
+static void considerWake(time_t *next, const char **reason, time_t now, time_t at, const char *why) {
+  if (at >= now + MIN_SLEEP && at < *next) {
+    *next = at;
+    *reason = why;
+  }
+}
+
+// Seconds until the panel has something new to show, from the state just
+// refreshed:
+// - the refresh interval for the current weather, longer on a low
+//   battery, rounded to the nearest hour OpenWeather publishes at
+// - the next forecast slot, when the later weather moves on
+// - midnight, for the date
+// - sunrise and sunset, when the weather icons turn to night or day
+// A wake falling in the quiet hours is moved to their end. On a very low
+// battery only the interval and the date count.
+uint32_t scheduleWake() {
+  time_t now = time(NULL);
+  time_t local = now + state.offset;
+  time_t today = local - local % 86400 - state.offset;  // local midnight, in UTC
+  bool veryLow = batteryVoltage < VERY_LOW_BATTERY_VOLTAGE;
+
+  time_t next = now + refreshInterval() + 1800 - PUBLISH_DELAY;
+  next = next - next % 3600 + PUBLISH_DELAY;
+  const char *reason = "refresh interval";
+
+  considerWake(&next, &reason, now, today + 86400 + DATE_MARGIN, "date");
+  if (!veryLow) {
+    // the first slot of the list is the one before laterTime
+    time_t slot = state.laterTime - state.offset - FORECAST_SLOT;
+    if (slot <= now) slot += ((now - slot) / FORECAST_SLOT + 1) * FORECAST_SLOT;
+    considerWake(&next, &reason, now, slot + PUBLISH_DELAY, "forecast slot");
+
+    const char *sunTimes[] = {state.todaySunrise, state.todaySunset};
+    for (int i = 0; i < 2; i++) {
+      int h, m;
+      if (sscanf(sunTimes[i], "%d:%d", &h, &m) == 2) {
+        considerWake(&next, &reason, now, today + h * 3600 + m * 60 + PUBLISH_DELAY, i == 0 ? "sunrise" : "sunset");
+      }
+    }
+  }
+
+  const Settings *settings = &cachedSettings;
+  time_t nextLocal = next + state.offset;
+  if (isQuietHour(nextLocal / 3600 % 24, settings->quietStart, settings->quietEnd)) {
+    time_t end = nextLocal - nextLocal % 86400 + settings->quietEnd * 3600;
+    if (end <= nextLocal) end += 86400;
+    next = end - state.offset;
+    nextLocal = end;
+    reason = "end of the quiet hours";
+  }
+
+  Serial.printf("Next wake at %02d:%02d, for the %s\r\n", hour(nextLocal), minute(nextLocal), reason);
+  return next - now;
+}
+
+// Seconds between refreshes of the current weather, longer as the battery
+// runs down
+uint32_t refreshInterval() {
+  if (batteryVoltage < VERY_LOW_BATTERY_VOLTAGE) return REFRESH_INTERVAL * 4;
+  if (batteryVoltage < LOW_BATTERY_VOLTAGE) return REFRESH_INTERVAL * 2;
+  return REFRESH_INTERVAL;
+}
+
+// Whether `hour` is in [start, end), which may wrap around midnight
+bool RTC_IRAM_ATTR isQuietHour(uint32_t hour, uint8_t start, uint8_t end) {
+  if (start == end) return false;
+  if (start < end) return hour >= start && hour < end;
+  return hour >= start || hour < end;
+}
+
+// Seconds the timer wake the stub runs in can sleep on for, at `local`
+// time, 0 when it is due. scheduleWake() plans no wake in the quiet hours
+// and none before the schedule, so what is slept through here are retries
+// after a failed refresh:
+// - in the quiet hours, until they end
+// - on a very low battery, until the next wake on the schedule
+static uint32_t RTC_IRAM_ATTR stubSleepFor(uint32_t local) {
+  if (isQuietHour(local / 3600 % 24, stubPlan.quietStart, stubPlan.quietEnd)) {
+    return (stubPlan.quietEnd * 3600 + 86400 - local % 86400) % 86400;
+  }
+  if (stubPlan.batteryMv < (uint16_t)(VERY_LOW_BATTERY_VOLTAGE * 1000) && stubPlan.scheduled > local + MIN_SLEEP) {
+    return stubPlan.scheduled - local;
+  }
+  return 0;
+}
+
+// Back to deep sleep for `seconds`, straight from the stub. On the ESP32
+// only registers and ROM functions: flash isn't mapped yet.
+static void RTC_IRAM_ATTR stubSleep(uint32_t seconds) {
+#ifdef ARDUINO_ARCH_ESP32
+  SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+  while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0) {
+    ets_delay_us(1);
+  }
+  SET_PERI_REG_MASK(RTC_CNTL_INT_CLR_REG, RTC_CNTL_TIME_VALID_INT_CLR);
+  uint64_t wake = READ_PERI_REG(RTC_CNTL_TIME0_REG);
+  wake |= (uint64_t)READ_PERI_REG(RTC_CNTL_TIME1_REG) << 32;
+  wake += (uint64_t)seconds * stubPlan.ticksPerSecond;
+  // the timer wakeup stays enabled from the last sleep, only its alarm moves
+  WRITE_PERI_REG(RTC_CNTL_SLP_TIMER0_REG, wake & UINT32_MAX);
+  WRITE_PERI_REG(RTC_CNTL_SLP_TIMER1_REG, wake >> 32);
+
+  REG_WRITE(RTC_ENTRY_ADDR_REG, (uint32_t)&esp_wake_deep_sleep);
+  CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+  SET_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_SLEEP_EN);
+  while (true) {
+  }
+#else
+  esp_sleep_enable_timer_wakeup(seconds * uS_TO_S_FACTOR);
+  esp_deep_sleep_start();
+#endif
+}
+
+// Runs on every wake from deep sleep before the app is loaded. Timer wakes
+// that don't need a refresh go back to sleep from here, without paying for
+// the boot, the filesystem and the ADC calibration. Touch wakes, and any
+// wake before a refresh ever succeeded, always boot.
+void RTC_IRAM_ATTR esp_wake_deep_sleep(void) {
+  esp_default_wake_deep_sleep();
+  if (!stubPlan.valid) return;
+#ifdef ARDUINO_ARCH_ESP32
+  bool timer = REG_GET_FIELD(RTC_CNTL_WAKEUP_STATE_REG, RTC_CNTL_WAKEUP_CAUSE) & RTC_TIMER_TRIG_EN;
+#else
+  bool timer = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER;
+#endif
+  if (!timer) return;
+
+  // the local time is counted from the last time the app ran
+  stubPlan.elapsed += stubPlan.sleeping;
+  uint32_t seconds = stubSleepFor(stubPlan.sleptAt + stubPlan.elapsed);
+  if (seconds > 0) {
+    stubPlan.noopWakes++;
+    stubPlan.sleeping = seconds;
+    stubSleep(seconds);
+  }
+}
+
+// What the wake stub needs to know about the coming timer wakes
+void planWakeStub(uint32_t seconds) {
+  // the clock keeps running in deep sleep, the offset is the last received
+  if (failedRefreshes == 0 && state.dt != 0) {
+    stubPlan.valid = true;
+    stubPlan.offset = state.offset;
+  }
+#ifdef ARDUINO_ARCH_ESP32
+  stubPlan.ticksPerSecond = rtc_time_us_to_slowclk(uS_TO_S_FACTOR, REG_READ(RTC_SLOW_CLK_CAL_REG));
+#endif
+  uint32_t local = time(NULL) + stubPlan.offset;
+  stubPlan.sleptAt = local;
+  stubPlan.sleeping = seconds;
+  stubPlan.elapsed = 0;
+  // a refresh sleeps until the scheduled wake, retries keep it, or set the
+  // next one an interval away once it has passed
+  if (failedRefreshes == 0) {
+    stubPlan.scheduled = local + seconds;
+  } else if (stubPlan.scheduled <= local) {
+    stubPlan.scheduled = local + refreshInterval();
+  }
+  stubPlan.batteryMv = batteryVoltage * 1000;
+  stubPlan.quietStart = cachedSettings.quietStart;
+  stubPlan.quietEnd = cachedSettings.quietEnd;
+  stubPlan.noopWakes = 0;
+}
+
 void sleepDeep() {
-  esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_S_FACTOR);
+  recordWakeTrace();
+  uint32_t seconds = sleepTime();
+  Serial.print(F("Sleeping for "));
+  Serial.print(seconds);
+  Serial.println(F(" s"));
+  planWakeStub(seconds);
+  esp_sleep_enable_timer_wakeup(seconds * uS_TO_S_FACTOR);
 
   touchAttachInterrupt(T3, touchCallback, TOUCH_THRESHOLD);
   esp_sleep_enable_touchpad_wakeup();
   esp_deep_sleep_start();
 }
 
+// CPU clock per stage: fast where the CPU is the bottleneck (handshake,
+// inflating and parsing, drawing), slow where it waits on the radio, the NTP
+// server or the panel. Between stages, the setup() pauses and the wait for
+// the network task included, it runs slow. When both cores are in a stage,
+// the faster one wins.
+const CpuSpeed stageSpeeds[STAGE_COUNT] = {
+  CPU_SLOW,  // STAGE_READ_BATTERY
+  CPU_SLOW,  // STAGE_FS_BEGIN
+  CPU_SLOW,  // STAGE_LOAD_SETTINGS
+  CPU_SLOW,  // STAGE_CONNECT_WIFI
+  CPU_FAST,  // STAGE_TLS_HANDSHAKE
+  CPU_FAST,  // STAGE_REFRESH_WEATHER
+  CPU_FAST,  // STAGE_REFRESH_FORECAST
+  CPU_SLOW,  // STAGE_REFRESH_DIGEST, its handshake runs fast
+  CPU_SLOW,  // STAGE_SET_CLOCK
+  CPU_SLOW,  // STAGE_DISPLAY_INIT
+  CPU_FAST,  // STAGE_DISPLAY_DATE
+  CPU_FAST,  // STAGE_DISPLAY_SUNSET
+  CPU_FAST,  // STAGE_DISPLAY_WEATHER
+  CPU_FAST,  // STAGE_DISPLAY_FORECAST
+  CPU_FAST,  // STAGE_DISPLAY_LAST_UPDATE
+  CPU_FAST,  // STAGE_DISPLAY_BATTERY
+  CPU_FAST,  // STAGE_DISPLAY_PAGE
+  CPU_SLOW,  // STAGE_DISPLAY_REFRESH, the BUSY wait
+  CPU_SLOW,  // STAGE_DISPLAY_HIBERNATE
+};
+
 void setup() {
   pinMode(ledPin, OUTPUT);
   updateInProgress();
 
+  spanBegin(STAGE_READ_BATTERY);
   batteryVoltage = readBattery();
+  spanEnd(STAGE_READ_BATTERY);
   Serial.printf("Voltage: %4.3f V\r\n", batteryVoltage);
 
   if (batteryVoltage < CRITICALLY_LOW_BATTERY_VOLTAGE) {
@@ -59,22 +348,52 @@ void setup() {
   }
 
   Serial.begin(115200);
-  if (!LittleFS.begin()) {
-    Serial.println(F("An Error has occurred while mounting LittleFS"));
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TOUCHPAD) {
+    printWakeTraces();
+  }
+  if (stubPlan.noopWakes > 0) {
+    Serial.printf("%u wakes slept through by the wake stub\r\n", stubPlan.noopWakes);
+  }
+
+  // icons are in flash, the filesystem is only needed for the settings on a
+  // cold boot and for icons missing from the atlas
+  if (!settingsCached && !mountFs()) {
+    // retried with backoff like a failed refresh, not left awake in loop()
+    countFailedRefresh();
+    updateDone();
+    sleepDeep();
     return;
   }
 
   Serial.println("");
   Serial.print(F("Setup start: "));
-  refreshData();
-  printState();
+  // the network runs on the other core, this one sets the display up and
+  // draws what only depends on the current weather while the forecast is
+  // still downloading
+  if (xTaskCreatePinnedToCore(networkTask, "network", NETWORK_TASK_STACK, NULL, 1, NULL, NETWORK_CORE) != pdPASS) {
+    publishState(refreshData() ? STATE_COMPLETE : STATE_FAILED);
+  }
+  if (waitForState(STATE_WEATHER) == STATE_WEATHER) {
+    prepareDisplay();
+  }
 
-  delay(100);
-  Serial.println(F("memory before display: "));
-  Serial.println(ESP.getFreeHeap(), DEC);
-  refreshDisplay();
+  if (waitForState(STATE_COMPLETE) == STATE_COMPLETE) {
+    failedRefreshes = 0;
+    printState();
+
+    delay(100);
+    Serial.println(F("memory before display: "));
+    Serial.println(ESP.getFreeHeap(), DEC);
+    refreshDisplay();
+  } else {
+    // the panel keeps showing the last data, retried with backoff
+    countFailedRefresh();
+    if (display) {
+      display->hibernate();
+    }
+  }
 
-  LittleFS.end();
+  unmountFs();
   Serial.print(F("Setup end: "));
   Serial.println(ESP.getFreeHeap(), DEC);
 
@@ -87,6 +406,32 @@ void setup() {
   sleepDeep();
 }
 
+// Counts a refresh that didn't happen, sleepTime() backs off the retries
+void countFailedRefresh() {
+  if (failedRefreshes < 255) failedRefreshes++;
+  Serial.print(F("Refresh failed, attempt "));
+  Serial.println(failedRefreshes);
+}
+
+bool mountFs() {
+  if (!fsMounted) {
+    spanBegin(STAGE_FS_BEGIN);
+    fsMounted = LittleFS.begin();
+    spanEnd(STAGE_FS_BEGIN);
+    if (!fsMounted) {
+      Serial.println(F("An Error has occurred while mounting LittleFS"));
+    }
+  }
+  return fsMounted;
+}
+
+void unmountFs() {
+  if (fsMounted) {
+    LittleFS.end();
+    fsMounted = false;
+  }
+}
+
 void printState() {
   Serial.print(F("dt: "));
   Serial.println(state.dt);
@@ -143,69 +488,294 @@ void toMonthStr(char * dest, int monthIdx /* 1-indexed */) {
   strcpy(dest, months[monthIdx-1]);
 }
 
-bool dayChanged() {
-  if (dayChangedCache == -1) {
-    unsigned long now_t = state.dt + state.offset;
-    if (lastUpdate == 0
-      || day(now_t) != day(lastUpdate)
-      || month(now_t) != month(lastUpdate)
-      || year(now_t) != year(lastUpdate)) {
-        Serial.println("day changed");
-      dayChangedCache = 1;
-    } else {
-      Serial.println("day didn't change");
-      dayChangedCache = 0;
-    }
-    lastUpdate = now_t;
+void toLastUpdateStr(char * dest) {
+  time_t now;
+  time(&now);
+  now += state.offset;
+  snprintf(dest, 6, "%02d:%02d", hour(now), minute(now));
+}
+
+void toVoltageStr(char * dest) {
+  snprintf(dest, 6, "%2.1f V", batteryVoltage);
+}
+
+// FNV-1a
+uint32_t hashBytes(uint32_t hash, const void *data, size_t len) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+uint32_t hashInt(uint32_t hash, int value) {
+  return hashBytes(hash, &value, sizeof(value));
+}
+
+uint32_t hashStr(uint32_t hash, const char *str) {
+  return hashBytes(hash, str, strlen(str) + 1);
+}
+
+// Hash of everything the region's draw function renders, so a region whose
+// hash matches regionHashes[] would come out identical on the panel
+uint32_t regionHash(int region) {
+  uint32_t hash = 2166136261;
+  char str[6];
+  unsigned long now_t = state.dt + state.offset;
+
+  switch (region) {
+    case REGION_DATE:
+      hash = hashInt(hash, year(now_t));
+      hash = hashInt(hash, month(now_t));
+      hash = hashInt(hash, day(now_t));
+      break;
+    case REGION_SUNSET:
+      hash = hashStr(hash, state.todaySunrise);
+      hash = hashStr(hash, state.todaySunset);
+      break;
+    case REGION_WEATHER:
+      hash = hashInt(hash, state.currentTemp);
+      hash = hashStr(hash, state.currentWeather);
+      hash = hashInt(hash, hour(state.laterTime));
+      hash = hashInt(hash, minute(state.laterTime));
+      hash = hashInt(hash, state.laterTemp);
+      hash = hashStr(hash, state.laterWeather);
+      break;
+    case REGION_FORECAST:
+      for (int i = 0; i < 3; i++) {
+        hash = hashStr(hash, state.forecast[i].day);
+        hash = hashInt(hash, state.forecast[i].morningTemp);
+        hash = hashStr(hash, state.forecast[i].morningWeather);
+        hash = hashInt(hash, state.forecast[i].afternoonTemp);
+        hash = hashStr(hash, state.forecast[i].afternoonWeather);
+      }
+      break;
+    case REGION_LAST_UPDATE:
+      toLastUpdateStr(str);
+      hash = hashStr(hash, str);
+      break;
+    case REGION_BATTERY:
+      toVoltageStr(str);
+      hash = hashStr(hash, str);
+      break;
   }
-  return bool(dayChangedCache);
+  return hash;
 }
 
-void refreshData() {
+// Fetches the weather and the forecast into `state`. Every network step is
+// bounded, returns false as soon as one fails.
+bool refreshData() {
   Settings settings;
+  spanBegin(STAGE_LOAD_SETTINGS);
   loadSettings(&settings);
+  spanEnd(STAGE_LOAD_SETTINGS);
+
+  spanBegin(STAGE_CONNECT_WIFI);
+  bool ok = connectToWifi(&settings);
+  spanEnd(STAGE_CONNECT_WIFI);
+  if (!ok) {
+    Serial.println(F("WiFi connection failed"));
+    disconnectWifi();
+    return false;
+  }
+
+  if (settings.digestUrl[0] != '\0') {
+    spanBegin(STAGE_REFRESH_DIGEST);
+    ok = refreshDigest(&settings);
+    spanEnd(STAGE_REFRESH_DIGEST);
+  } else {
+    ok = refreshFromApi(&settings);
+  }
+
+  if (ok) {
+    spanBegin(STAGE_SET_CLOCK);
+    setClock();
+    spanEnd(STAGE_SET_CLOCK);
+  }
+
+  disconnectWifi();
+  return ok;
+}
+
+// Runs refreshData() on NETWORK_CORE, then publishes how it went
+void networkTask(void *parameter) {
+  publishState(refreshData() ? STATE_COMPLETE : STATE_FAILED);
+  vTaskDelete(NULL);
+}
 
-  connectToWifi(&settings);
-  setClock();
+// `state` is a single slot with one writer, the network task, and one
+// reader, setup(): the release store makes the fields written before it
+// visible to whoever sees `progress` with the acquire load of waitForState()
+void publishState(StateProgress progress) {
+  stateProgress.store(progress, std::memory_order_release);
+}
 
-  WiFiClientSecure *client = new WiFiClientSecure();
+// Waits for the network task to get to `progress`, or to fail: returns
+// where it is
+uint8_t waitForState(StateProgress progress) {
+  uint8_t current;
+  while ((current = stateProgress.load(std::memory_order_acquire)) < progress) {
+    vTaskDelay(pdMS_TO_TICKS(STATE_POLL_INTERVAL));
+  }
+  return current;
+}
+
+// The weather and, when it expired, the forecast from OpenWeather
+bool refreshFromApi(Settings *settings) {
+  WiFiClientSecure *client = new ResumingClientSecure();
   client->setCACertBundle(rootca_crt_bundle_start);
 
-  refreshWeather(&settings, client);
-  Serial.println(ESP.getFreeHeap(), DEC);
-  refreshForecast(&settings, client);
+  // connect up front so the handshake is timed on its own, HTTPClient reuses
+  // the open connection for the first request
+  spanBegin(STAGE_TLS_HANDSHAKE);
+  bool ok = client->connect(openWeatherHost, 443);
+  spanEnd(STAGE_TLS_HANDSHAKE);
+  if (!ok) {
+    Serial.println(F("TLS connection failed"));
+  }
+
+  if (ok) {
+    // one HTTP/1.1 client for both requests: the connection is kept alive
+    // in between, so there is a single TLS handshake per wake
+    HTTPClient http;
+    http.setReuse(true);
+    http.setConnectTimeout(HTTP_TIMEOUT);
+    http.setTimeout(HTTP_TIMEOUT);
+    const char *headerKeys[] = {"Transfer-Encoding", "Content-Encoding", "Date"};
+    http.collectHeaders(headerKeys, 3);
+
+    spanBegin(STAGE_REFRESH_WEATHER);
+    ok = refreshWeather(settings, client, &http);
+    spanEnd(STAGE_REFRESH_WEATHER);
+    if (ok && forecastExpired()) {
+      Serial.println(ESP.getFreeHeap(), DEC);
+      spanBegin(STAGE_REFRESH_FORECAST);
+      ok = refreshForecast(settings, client, &http);
+      spanEnd(STAGE_REFRESH_FORECAST);
+    } else if (ok) {
+      restoreForecast();
+    }
+  } // HTTPClient stops the connection when destroyed
 
   delete client;
   client = NULL;
-
-  disconnectWifi();
+  return ok;
 }
 
-void clearDisplay() {
-  Serial.println(F("clear display"));
-  display.setFullWindow();
-  display.firstPage();
+// The whole state, aggregated by the digest proxy (tools/digest_proxy.py), in
+// one small response. Plain HTTP when the URL says so, to skip TLS on a
+// trusted network.
+bool refreshDigest(Settings *settings) {
+  // with no key in the settings the proxy uses its own, and none travels
+  char url[160];
+  int length = snprintf(url, sizeof(url), "%s/state?q=%s", settings->digestUrl, settings->OWLocation);
+  if (settings->OWApiKey[0] != '\0' && length > 0 && length < (int)sizeof(url)) {
+    snprintf(url + length, sizeof(url) - length, "&APPID=%s", settings->OWApiKey);
+  }
+  Serial.println(url);
 
-  do
-  {
-    display.fillScreen(GxEPD_WHITE);
+  WiFiClient *client;
+  if (strncmp(settings->digestUrl, "https://", 8) == 0) {
+    WiFiClientSecure *secure = new ResumingClientSecure();
+    secure->setCACertBundle(rootca_crt_bundle_start);
+    client = secure;
+
+    // connect up front as refreshFromApi() does, so the handshake is its
+    // own stage, timed and clocked as such
+    const char *start = settings->digestUrl + 8;
+    size_t length = strcspn(start, ":/");
+    uint16_t port = start[length] == ':' ? atoi(start + length + 1) : 443;
+    char host[64];
+    snprintf(host, sizeof(host), "%.*s", (int)length, start);
+    spanBegin(STAGE_TLS_HANDSHAKE);
+    bool connected = secure->connect(host, port);
+    spanEnd(STAGE_TLS_HANDSHAKE);
+    if (!connected) {
+      Serial.println(F("TLS connection failed"));
+      delete client;
+      return false;
+    }
+  } else {
+    client = new WiFiClient();
   }
-  while (display.nextPage());
+
+  bool ok = false;
+  {
+    HTTPClient http;
+    http.setReuse(true);  // takes over the connection opened above
+    http.setConnectTimeout(HTTP_TIMEOUT);
+    http.setTimeout(HTTP_TIMEOUT);
+    const char *headerKeys[] = {"Transfer-Encoding", "Date"};
+    http.collectHeaders(headerKeys, 2);
+
+    http.begin(*client, url);
+    int httpCode = http.GET();
+    if (httpCode == HTTP_CODE_OK) {
+      time_t date = parseHttpDate(http.header("Date").c_str());
+      uint8_t blob[STATE_BLOB_SIZE];
+      HttpBodyStream body = responseBody(&http);
+      size_t length = body.readBytes(blob, sizeof(blob));
+      ok = parseStateBlob(blob, length, &state);
+      if (ok) setClockFromResponse(date);
+    } else {
+      Serial.print(F("Digest request failed: "));
+      Serial.println(httpCode);
+    }
+    http.end();
+  } // HTTPClient stops the connection when destroyed
+
+  delete client;
+  return ok;
 }
 
-void displayDate() {
-  uint16_t w = 240;
-  uint16_t h = 280;
-  
+// Fields of the BMP files and of the state blob are little-endian, same as
+// Arduino.
+static inline uint16_t le16(const uint8_t *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Copies a NUL padded string of the state blob, terminated whatever it holds
+static void blobString(char *dest, const uint8_t *src, size_t size) {
+  memcpy(dest, src, size);
+  dest[size - 1] = '\0';
+}
 
+// The state served by the digest proxy, format in tools/digest_proxy.py
+bool parseStateBlob(const uint8_t *data, size_t length, State *state) {
+  if (length < STATE_BLOB_SIZE || le32(data) != STATE_BLOB_MAGIC) {
+    Serial.println(F("not a state blob or truncated"));
+    return false;
+  }
+  state->dt = le32(data + 4);
+  state->offset = (int32_t)le32(data + 8);
+  state->currentTemp = (int16_t)le16(data + 12);
+  blobString(state->currentWeather, data + 14, 4);
+  state->laterTime = (int32_t)le32(data + 18);
+  state->laterTemp = (int16_t)le16(data + 22);
+  blobString(state->laterWeather, data + 24, 4);
+  blobString(state->todaySunrise, data + 28, 6);
+  blobString(state->todaySunset, data + 34, 6);
+  for (int i = 0; i < 3; i++) {
+    const uint8_t *day = data + STATE_BLOB_HEADER_SIZE + i * STATE_BLOB_DAY_SIZE;
+    blobString(state->forecast[i].day, day, 4);
+    state->forecast[i].morningTemp = (int16_t)le16(day + 4);
+    blobString(state->forecast[i].morningWeather, day + 6, 4);
+    state->forecast[i].afternoonTemp = (int16_t)le16(day + 10);
+    blobString(state->forecast[i].afternoonWeather, day + 12, 4);
+  }
+  return true;
+}
+
+void drawDate() {
   uint16_t x = 0;
   uint16_t y = 0;
   int16_t tbx, tby; uint16_t tbw, tbh;
 
-  display.setRotation(0);
-  display.setPartialWindow(0, 0, w, h);
-  display.firstPage();
-
   unsigned long now_t = state.dt + state.offset;
   
   char weekdayStr[4] = "";
@@ -217,51 +787,44 @@ void displayDate() {
 
   int leftCol = 0;
 
-  do
-  {
-    display.fillScreen(GxEPD_WHITE);
-
-    // day of week
-    display.setTextColor(GxEPD_RED);
-    display.setFont(&FreeMonoBold64pt7b);
-    display.getTextBounds(weekdayStr, 0, 0, &tbx, &tby, &tbw, &tbh);
-
-    leftCol = tbw + 10;
-    x = (leftCol - tbw) / 2;
-    y = tbh + 15;
-    display.setCursor(x, y);
-    display.print(weekdayStr);
-
-    // month
-    display.setTextColor(GxEPD_BLACK);
-    display.setFont(&FreeMonoBold24pt7b);
-    display.getTextBounds(monthStr, 0, 0, &tbx, &tby, &tbw, &tbh);
-    x = (leftCol - tbw) / 2;
-    y = y + tbh + 30;
-    display.setCursor(x, y);
-    display.print(monthStr);
-
-    // day
-    display.setTextColor(GxEPD_RED);
-    display.setFont(&FreeMonoBold64pt7b);
-    display.getTextBounds(dayStr, 0, 0, &tbx, &tby, &tbw, &tbh);
-    x = (leftCol - tbw) / 2;
-    y = y + tbh + 30;
-    display.setCursor(x, y);
-    display.print(dayStr);
-  }
-  while (display.nextPage());
-  delay(100);
+  // day of week
+  frame.setTextColor(GxEPD_RED);
+  frame.setFont(&FreeMonoBold64pt7b);
+  frame.getTextBounds(weekdayStr, 0, 0, &tbx, &tby, &tbw, &tbh);
+
+  leftCol = tbw + 10;
+  x = (leftCol - tbw) / 2;
+  y = tbh + 15;
+  frame.setCursor(x, y);
+  frame.print(weekdayStr);
+
+  // month
+  frame.setTextColor(GxEPD_BLACK);
+  frame.setFont(&FreeMonoBold24pt7b);
+  frame.getTextBounds(monthStr, 0, 0, &tbx, &tby, &tbw, &tbh);
+  x = (leftCol - tbw) / 2;
+  y = y + tbh + 30;
+  frame.setCursor(x, y);
+  frame.print(monthStr);
+
+  // day
+  frame.setTextColor(GxEPD_RED);
+  frame.setFont(&FreeMonoBold64pt7b);
+  frame.getTextBounds(dayStr, 0, 0, &tbx, &tby, &tbw, &tbh);
+  x = (leftCol - tbw) / 2;
+  y = y + tbh + 30;
+  frame.setCursor(x, y);
+  frame.print(dayStr);
 }
 
-void displayWeather()
+void drawWeather()
 {
-  const uint16_t initial_x = 240;
-  const uint16_t initial_y = 30;
+  const Region *region = &regions[REGION_WEATHER];
+  const uint16_t initial_x = region->x;
+  const uint16_t initial_y = region->y;
+  const uint16_t w = region->w;
   uint16_t x = initial_x;
   uint16_t y = initial_y;
-  uint16_t w = 210;
-  uint16_t h = 410;
 
   int16_t tbx, tby; uint16_t tbw, tbh;
   
@@ -275,127 +838,102 @@ void displayWeather()
   const int laterIconSize = 64;
 
   char icon[12] = "";
-  snprintf(icon, 12, "%s_%d.bmp", state.currentWeather, iconSize);
+  snprintf(icon, 12, "%s_%d", state.currentWeather, iconSize);
 
   char laterIcon[12] = "";
-  snprintf(laterIcon, 12, "%s_%d.bmp", state.laterWeather, laterIconSize);
+  snprintf(laterIcon, 12, "%s_%d", state.laterWeather, laterIconSize);
 
   char laterTimeStr[6];
   snprintf(laterTimeStr, 6, "%02d:%02d", hour(state.laterTime), minute(state.laterTime));
 
-  display.setRotation(0);
-  display.setPartialWindow(x, y, w, h);
-  display.firstPage();
+  // weather
+  x = initial_x + (w - iconSize) / 2;
+  y = initial_y;
+  drawIcon(icon, x, y);
+
+  // temp
+  frame.setTextColor(GxEPD_BLACK);
+  frame.setFont(&FreeMonoBold48pt7b);
+  frame.getTextBounds(temp, 0, 0, &tbx, &tby, &tbw, &tbh);
+  x = initial_x + (w - tbw) / 2 - 10;
+  y = y + iconSize + tbh + 20;
+  frame.setCursor(x, y);
+  frame.print(temp);
+  // degree symbol (the letter "o")
+  frame.setFont(&FreeMonoBold12pt7b);
+  frame.setCursor(x + tbw + 15, y-tbh+9);
+  frame.print("o");
+
+  // later time
+  frame.setTextColor(GxEPD_RED);
+  frame.setFont(&FreeMonoBold18pt7b);
+  frame.getTextBounds(laterTimeStr, 0, 0, &tbx, &tby, &tbw, &tbh);
+  x = initial_x;
+  y = y + tbh + 60;
+  frame.setCursor(x, y);
+  frame.print(laterTimeStr);
   
-  do
-  {
-    display.fillScreen(GxEPD_WHITE);
-
-    // weather
-    x = initial_x + (w - iconSize) / 2;
-    y = initial_y;
-    drawBitmapFromSpiffs(icon, x, y, false);
-
-    // temp
-    display.setTextColor(GxEPD_BLACK);
-    display.setFont(&FreeMonoBold48pt7b);
-    display.getTextBounds(temp, 0, 0, &tbx, &tby, &tbw, &tbh);
-    x = initial_x + (w - tbw) / 2 - 10;
-    y = y + iconSize + tbh + 20;
-    display.setCursor(x, y);
-    display.print(temp);
-    // degree symbol (the letter "o")
-    display.setFont(&FreeMonoBold12pt7b);
-    display.setCursor(x + tbw + 15, y-tbh+9);
-    display.print("o");
-
-    // later time
-    display.setTextColor(GxEPD_RED);
-    display.setFont(&FreeMonoBold18pt7b);
-    display.getTextBounds(laterTimeStr, 0, 0, &tbx, &tby, &tbw, &tbh);
-    x = initial_x;
-    y = y + tbh + 60;
-    display.setCursor(x, y);
-    display.print(laterTimeStr);
-    
-    // later weather
-    x = initial_x + 10;
-    y = y + 15;
-    drawBitmapFromSpiffs(laterIcon, x, y, false);
-
-    // later temp
-    display.setTextColor(GxEPD_BLACK);
-    display.setFont(&FreeMonoBold24pt7b);
-    display.getTextBounds(laterTemp, 0, 0, &tbx, &tby, &tbw, &tbh);
-    x = initial_x + 20 + laterIconSize;
-    y = y + tbh + 15;
-    display.setCursor(x, y);
-    display.print(laterTemp);
-    // degree symbol (the letter "o")
-    display.setFont(&FreeMonoBold9pt7b);
-    display.setCursor(x + tbw + 10, y-tbh+9);
-    display.print("o");
-  }
-  while (display.nextPage());
-  delay(100);
+  // later weather
+  x = initial_x + 10;
+  y = y + 15;
+  drawIcon(laterIcon, x, y);
+
+  // later temp
+  frame.setTextColor(GxEPD_BLACK);
+  frame.setFont(&FreeMonoBold24pt7b);
+  frame.getTextBounds(laterTemp, 0, 0, &tbx, &tby, &tbw, &tbh);
+  x = initial_x + 20 + laterIconSize;
+  y = y + tbh + 15;
+  frame.setCursor(x, y);
+  frame.print(laterTemp);
+  // degree symbol (the letter "o")
+  frame.setFont(&FreeMonoBold9pt7b);
+  frame.setCursor(x + tbw + 10, y-tbh+9);
+  frame.print("o");
 }
 
-void displaySunset() {
-  const uint16_t initial_x = 10;
-  const uint16_t initial_y = 330;
+void drawSunset() {
+  const uint16_t initial_x = regions[REGION_SUNSET].x;
+  const uint16_t initial_y = regions[REGION_SUNSET].y;
   uint16_t x = initial_x;
   uint16_t y = initial_y;
-  const uint16_t w = 200;
-  const uint16_t h = 100;
 
   int16_t tbx, tby; uint16_t tbw, tbh;
 
-  display.setRotation(0);
-  display.setPartialWindow(x, y, w, h);
-  display.firstPage();
-
-  char * sunriseIcon = "sun-rise_36.bmp";
-  char * sunsetIcon = "sun-set_36.bmp";
+  const char * sunriseIcon = "sun-rise_36";
+  const char * sunsetIcon = "sun-set_36";
   const int iconSize = 36;
 
-  do
-  {
-    display.fillScreen(GxEPD_WHITE);
-    // sunrise
-    x = initial_x + 20;
-    y = initial_y;
-    drawBitmapFromSpiffs(sunriseIcon, x, y, false);
-
-    display.setTextColor(GxEPD_BLACK);
-    display.setFont(&FreeMonoBold12pt7b);
-    display.getTextBounds(state.todaySunrise, 0, 0, &tbx, &tby, &tbw, &tbh);
-    x = x + iconSize + 10;
-    y = y + tbh + 10;
-    display.setCursor(x, y);
-    display.print(state.todaySunrise);
-
-    // sunset
-    x = initial_x + 20;
-    y = y + 10;
-    drawBitmapFromSpiffs(sunsetIcon, x, y, false);
-
-    display.getTextBounds(state.todaySunset, 0, 0, &tbx, &tby, &tbw, &tbh);
-    x = x + iconSize + 10;
-    y = y + tbh + 10;
-    display.setCursor(x, y);
-    display.print(state.todaySunset);
-  }
-  while (display.nextPage());
-  delay(100);
-}
-
-void displayForecast() {
-  const uint16_t initial_x = 470;
-  const uint16_t initial_y = 10;
+  // sunrise
+  x = initial_x + 20;
+  y = initial_y;
+  drawIcon(sunriseIcon, x, y);
+
+  frame.setTextColor(GxEPD_BLACK);
+  frame.setFont(&FreeMonoBold12pt7b);
+  frame.getTextBounds(state.todaySunrise, 0, 0, &tbx, &tby, &tbw, &tbh);
+  x = x + iconSize + 10;
+  y = y + tbh + 10;
+  frame.setCursor(x, y);
+  frame.print(state.todaySunrise);
+
+  // sunset
+  x = initial_x + 20;
+  y = y + 10;
+  drawIcon(sunsetIcon, x, y);
+
+  frame.getTextBounds(state.todaySunset, 0, 0, &tbx, &tby, &tbw, &tbh);
+  x = x + iconSize + 10;
+  y = y + tbh + 10;
+  frame.setCursor(x, y);
+  frame.print(state.todaySunset);
+}
+
+void drawForecast() {
+  const uint16_t initial_x = regions[REGION_FORECAST].x;
+  const uint16_t initial_y = regions[REGION_FORECAST].y;
   uint16_t x = initial_x;
   uint16_t y = initial_y;
-  const uint16_t w = 648 - x - 1;
-  const uint16_t h = 430;
 
   int16_t tbx, tby; uint16_t tbw, tbh;
 
@@ -403,147 +941,474 @@ void displayForecast() {
   char icon[11] = "";
 
   const int iconSize = 36;
-  
-  display.setRotation(0);
-  display.setPartialWindow(x, y, w, h);
-  display.firstPage();
 
-  do
-  {
-    display.fillScreen(GxEPD_WHITE);
-    for (int i=0; i<3; i++) {
-      if (i == 0) {
-        y = initial_y;
-      }
-      // day
-      display.setTextColor(GxEPD_RED);
-      display.setFont(&FreeMonoBold24pt7b);
-      display.getTextBounds(state.forecast[i].day, 0, 0, &tbx, &tby, &tbw, &tbh);
-      y = y + (tbh + 20);
-      display.setCursor(x, y);
-      display.print(state.forecast[i].day);
-
-      // morning temp
-      display.setTextColor(GxEPD_BLACK);
-      display.setFont(&FreeMonoBold18pt7b);
-      snprintf(temp, 5, "% 3d", state.forecast[i].morningTemp);
-      display.getTextBounds(temp, 0, 0, &tbx, &tby, &tbw, &tbh);
-      y = y + (tbh + 12);
-      display.setCursor(x+10, y);
-      display.print(temp);
-      // degree symbol (the letter "o")
-      display.setFont(&FreeMonoBold9pt7b);
-      display.setCursor(x+13+tbw, y-tbh+6);
-      display.print("o");
-
-      // morning weather
-      snprintf(icon, 11, "%s_%d.bmp", state.forecast[i].morningWeather, iconSize);
-      drawBitmapFromSpiffs(icon, x + 110, y - iconSize + 10, false);
-
-      // afternoon temp
-      display.setTextColor(GxEPD_BLACK);
-      display.setFont(&FreeMonoBold18pt7b);
-      snprintf(temp, 5, "% 3d", state.forecast[i].afternoonTemp);
-      display.getTextBounds(temp, 0, 0, &tbx, &tby, &tbw, &tbh);
-      y = y + (tbh + 20);
-      display.setCursor(x+10, y);
-      display.print(temp);
-      // degree symbol (the letter "o")
-      display.setFont(&FreeMonoBold9pt7b);
-      display.setCursor(x+13+tbw, y-tbh+6);
-      display.print("o");
-
-      // afternoon weather
-      snprintf(icon, 11, "%s_%d.bmp", state.forecast[i].afternoonWeather, iconSize);
-      drawBitmapFromSpiffs(icon, x + 110, y - iconSize + 10, false);
-    }
+  for (int i=0; i<3; i++) {
+    // day
+    frame.setTextColor(GxEPD_RED);
+    frame.setFont(&FreeMonoBold24pt7b);
+    frame.getTextBounds(state.forecast[i].day, 0, 0, &tbx, &tby, &tbw, &tbh);
+    y = y + (tbh + 20);
+    frame.setCursor(x, y);
+    frame.print(state.forecast[i].day);
+
+    // morning temp
+    frame.setTextColor(GxEPD_BLACK);
+    frame.setFont(&FreeMonoBold18pt7b);
+    snprintf(temp, 5, "% 3d", state.forecast[i].morningTemp);
+    frame.getTextBounds(temp, 0, 0, &tbx, &tby, &tbw, &tbh);
+    y = y + (tbh + 12);
+    frame.setCursor(x+10, y);
+    frame.print(temp);
+    // degree symbol (the letter "o")
+    frame.setFont(&FreeMonoBold9pt7b);
+    frame.setCursor(x+13+tbw, y-tbh+6);
+    frame.print("o");
+
+    // morning weather
+    snprintf(icon, 11, "%s_%d", state.forecast[i].morningWeather, iconSize);
+    drawIcon(icon, x + 110, y - iconSize + 10);
+
+    // afternoon temp
+    frame.setTextColor(GxEPD_BLACK);
+    frame.setFont(&FreeMonoBold18pt7b);
+    snprintf(temp, 5, "% 3d", state.forecast[i].afternoonTemp);
+    frame.getTextBounds(temp, 0, 0, &tbx, &tby, &tbw, &tbh);
+    y = y + (tbh + 20);
+    frame.setCursor(x+10, y);
+    frame.print(temp);
+    // degree symbol (the letter "o")
+    frame.setFont(&FreeMonoBold9pt7b);
+    frame.setCursor(x+13+tbw, y-tbh+6);
+    frame.print("o");
+
+    // afternoon weather
+    snprintf(icon, 11, "%s_%d", state.forecast[i].afternoonWeather, iconSize);
+    drawIcon(icon, x + 110, y - iconSize + 10);
   }
-  while (display.nextPage());
-  delay(100);
 }
 
 void displayNextBus() {
   
 }
 
-void displayLastUpdate() {
-  const uint16_t x = 460;
-  const uint16_t y = 450;
-  const uint16_t w = 100;
-  const uint16_t h = 30;
+void drawLastUpdate() {
+  const uint16_t x = regions[REGION_LAST_UPDATE].x;
+  const uint16_t y = regions[REGION_LAST_UPDATE].y;
 
   int16_t tbx, tby; uint16_t tbw, tbh;
 
   char lastUpdateStr[6];
-  time_t now;
-  time(&now);
-  Serial.print("last update: ");
-  Serial.println(now);
-  now += state.offset;
-  snprintf(lastUpdateStr, 6, "%02d:%02d", hour(now), minute(now));
+  toLastUpdateStr(lastUpdateStr);
 
-  display.setRotation(0);
-  display.setPartialWindow(x, y, w, h);
-  display.firstPage();
-
-  do
-  {
-    display.fillScreen(GxEPD_WHITE);
-    display.setTextColor(GxEPD_BLACK);
-    display.setFont(&FreeMonoBold12pt7b);
-    display.getTextBounds(lastUpdateStr, 0, 0, &tbx, &tby, &tbw, &tbh);
-    display.setCursor(x, y+tbh);
-    display.print(lastUpdateStr);
-  }
-  while (display.nextPage());
-  delay(100);
+  frame.setTextColor(GxEPD_BLACK);
+  frame.setFont(&FreeMonoBold12pt7b);
+  frame.getTextBounds(lastUpdateStr, 0, 0, &tbx, &tby, &tbw, &tbh);
+  frame.setCursor(x, y+tbh);
+  frame.print(lastUpdateStr);
 }
 
-void displayBattery(){
-  const uint16_t x = 560;
-  const uint16_t y = 450;
-  const uint16_t w = 88;
-  const uint16_t h = 30;
+void drawBattery(){
+  const uint16_t x = regions[REGION_BATTERY].x;
+  const uint16_t y = regions[REGION_BATTERY].y;
 
   int16_t tbx, tby; uint16_t tbw, tbh;
 
   char voltage[6] = "";
-  snprintf(voltage, 6, "%2.1f V", batteryVoltage);
+  toVoltageStr(voltage);
+
+  frame.setTextColor(GxEPD_BLACK);
+  frame.setFont(&FreeMonoBold12pt7b);
+  frame.getTextBounds(voltage, 0, 0, &tbx, &tby, &tbw, &tbh);
+  frame.setCursor(x, y+tbh);
+  frame.print(voltage);
+}
+
+void DisplayList::clear() {
+  _length = 0;
+  _poolUsed = 0;
+  _text = NULL;
+}
+
+void DisplayList::setTextColor(uint16_t color) {
+  closeText();
+  _color = color;
+}
 
-  display.setRotation(0);
-  display.setPartialWindow(x, y, w, h);
-  display.firstPage();
+void DisplayList::setFont(const GFXfont *font) {
+  closeText();
+  _font = font;
+  display->setFont(font); // for getTextBounds
+}
+
+void DisplayList::setCursor(int16_t x, int16_t y) {
+  closeText();
+  _cursorX = x;
+  _cursorY = y;
+}
+
+void DisplayList::getTextBounds(const char *str, int16_t x, int16_t y, int16_t *x1, int16_t *y1, uint16_t *w, uint16_t *h) {
+  display->getTextBounds(str, x, y, x1, y1, w, h);
+}
+
+size_t DisplayList::write(uint8_t c) {
+  if (!_text) {
+    _text = append(DRAW_TEXT);
+    if (!_text) return 0;
+    _text->x = _cursorX;
+    _text->y = _cursorY;
+    _text->font = _font;
+    _text->color = _color;
+  }
+  size_t length = strlen(_text->text);
+  if (length + 1 >= sizeof(_text->text)) return 0;
+  _text->text[length] = c;
+  _text->text[length + 1] = '\0';
+  return 1;
+}
+
+// Ends the text op being written: its rows are only known once it is complete
+void DisplayList::closeText() {
+  if (!_text) return;
+  int16_t tbx, tby; uint16_t tbw, tbh;
+  display->setFont(_text->font);
+  display->getTextBounds(_text->text, _text->x, _text->y, &tbx, &tby, &tbw, &tbh);
+  display->setFont(_font);
+  _text->top = tby;
+  _text->bottom = tby + tbh;
+  _text = NULL;
+}
 
+// Records an image, its planes must stay valid until the frame is refreshed
+void DisplayList::drawImage(const uint8_t *black, const uint8_t *color, int16_t x, int16_t y, uint16_t w, uint16_t h) {
+  closeText();
+  DrawOp *op = append(DRAW_IMAGE);
+  if (!op) return;
+  op->x = x;
+  op->y = y;
+  op->w = w;
+  op->h = h;
+  op->top = y;
+  op->bottom = y + h;
+  op->black = black;
+  op->colorPlane = color;
+}
+
+// Room for the planes of an image decoded while recording, freed by clear()
+uint8_t *DisplayList::allocImage(uint16_t w, uint16_t h, bool with_color) {
+  uint32_t size = (uint32_t)(w + 7) / 8 * h * (with_color ? 2 : 1);
+  if (_poolUsed + size > sizeof(_pool)) {
+    Serial.println(F("display list: no room for image"));
+    return NULL;
+  }
+  uint8_t *planes = _pool + _poolUsed;
+  _poolUsed += size;
+  return planes;
+}
+
+DrawOp *DisplayList::append(uint8_t type) {
+  if (_length == DISPLAY_LIST_OPS) {
+    Serial.println(F("display list full"));
+    return NULL;
+  }
+  DrawOp *op = &_ops[_length++];
+  memset(op, 0, sizeof(*op));
+  op->type = type;
+  return op;
+}
+
+// Draws the ops touching rows [bandTop, bandBottom) into the page buffer
+void DisplayList::replay(int16_t bandTop, int16_t bandBottom) {
+  closeText();
+  for (uint8_t i = 0; i < _length; i++) {
+    const DrawOp *op = &_ops[i];
+    if (op->bottom <= bandTop || op->top >= bandBottom) continue;
+    if (op->type == DRAW_TEXT) {
+      display->setFont(op->font);
+      display->setTextColor(op->color);
+      display->setCursor(op->x, op->y);
+      display->print(op->text);
+    } else {
+      // only the rows inside the band
+      int16_t first = max(bandTop, op->top) - op->y;
+      int16_t last = min(bandBottom, op->bottom) - op->y;
+      uint16_t offset = (op->w + 7) / 8 * first;
+      display->drawInvertedBitmap(op->x, op->y + first, op->black + offset, op->w, last - first, GxEPD_BLACK);
+      if (op->colorPlane) {
+        display->drawInvertedBitmap(op->x, op->y + first, op->colorPlane + offset, op->w, last - first, GxEPD_RED);
+      }
+    }
+  }
+}
+
+// Renders the given regions (bitmask of REGION_*) into a single frame and
+// refreshes the panel once. The window is the smallest one that holds them
+// all, or the whole screen when `fullWindow` is set. Everything under the
+// window gets redrawn since it is cleared: returns the regions drawn.
+uint8_t composeFrame(uint8_t regionMask, bool fullWindow) {
+  uint16_t x0 = Panel::WIDTH, y0 = Panel::HEIGHT, x1 = 0, y1 = 0;
+  for (int i = 0; i < REGION_COUNT; i++) {
+    if (regionMask & (1 << i)) {
+      const Region *region = &regions[i];
+      x0 = min(x0, region->x);
+      y0 = min(y0, region->y);
+      x1 = max(x1, (uint16_t)(region->x + region->w));
+      y1 = max(y1, (uint16_t)(region->y + region->h));
+    }
+  }
+  if (x1 <= x0 || y1 <= y0) return 0;
+
+  if (fullWindow) {
+    x0 = 0;
+    y0 = 0;
+    x1 = Panel::WIDTH;
+    y1 = Panel::HEIGHT;
+  }
+  // the controller addresses whole bytes horizontally
+  x0 -= x0 % 8;
+  x1 = min((uint16_t)((x1 + 7) & ~7), (uint16_t)Panel::WIDTH);
+
+  uint8_t drawMask = 0;
+  for (int i = 0; i < REGION_COUNT; i++) {
+    const Region *region = &regions[i];
+    if (region->x < x1 && region->x + region->w > x0 && region->y < y1 && region->y + region->h > y0) {
+      drawMask |= 1 << i;
+    }
+  }
+
+  display->setRotation(0);
+  // the draw functions run once, each page replays what they recorded;
+  // regions recorded by prepareDisplay() are kept when they are drawn anyway
+  if (framedRegions & ~drawMask) {
+    frame.clear();
+    framedRegions = 0;
+  }
+  recordRegions(drawMask);
+
+  if (fullWindow) {
+    display->setFullWindow();
+  } else {
+    display->setPartialWindow(x0, y0, x1 - x0, y1 - y0);
+  }
+  display->firstPage();
+
+  int16_t bandTop = fullWindow ? 0 : y0;
+  bool morePages;
   do
   {
-    display.fillScreen(GxEPD_WHITE);
-    display.setTextColor(GxEPD_BLACK);
-    display.setFont(&FreeMonoBold12pt7b);
-    display.getTextBounds(voltage, 0, 0, &tbx, &tby, &tbw, &tbh);
-    display.setCursor(x, y+tbh);
-    display.print(voltage);
+    spanBegin(STAGE_DISPLAY_PAGE);
+    pageSpanOpen = true;
+    display->fillScreen(GxEPD_WHITE);
+    frame.replay(bandTop, bandTop + display->pageHeight());
+    bandTop += display->pageHeight();
+    morePages = display->nextPage();
+    pageSpanOpen = false;
+    spanEnd(STAGE_DISPLAY_PAGE);
   }
-  while (display.nextPage());
-  delay(100);
+  while (morePages);
+  return drawMask;
 }
 
-void refreshDisplay() {
+// Runs the draw functions of the given regions not recorded yet into `frame`
+void recordRegions(uint8_t regionMask) {
+  for (int i = 0; i < REGION_COUNT; i++) {
+    if ((regionMask & ~framedRegions) & (1 << i)) {
+      spanBegin(regions[i].stage);
+      regions[i].draw();
+      spanEnd(regions[i].stage);
+      framedRegions |= 1 << i;
+    }
+  }
+}
+
+// Times a wait on BUSY as the panel refresh. The page stage, which the last
+// nextPage() waits in, is left meanwhile, so the clock only drops to
+// CPU_SLOW for the wait.
+static void busyBegin() {
+  if (pageSpanOpen) spanEnd(STAGE_DISPLAY_PAGE);
+  spanBegin(STAGE_DISPLAY_REFRESH);
+}
+
+static void busyEnd() {
+  spanEnd(STAGE_DISPLAY_REFRESH);
+  if (pageSpanOpen) spanBegin(STAGE_DISPLAY_PAGE);
+}
+
+// Busy callbacks of the panel. GxEPD2 calls one in its loop waiting for
+// BUSY to go high, and reads the pin again when it returns. This one is the
+// delay(1) GxEPD2 does without a callback.
+void pollWhileBusy(const void *parameter) {
+  busyBegin();
+  delay(1);
+  busyEnd();
+}
+
+// Light sleep with a level wakeup on the pin gets the CPU off for the
+// seconds a refresh takes
+void sleepWhileBusy(const void *parameter) {
+  busyBegin();
+  Serial.flush();  // the UART stops in light sleep
+  gpio_wakeup_enable((gpio_num_t)PANEL_BUSY_PIN, GPIO_INTR_HIGH_LEVEL);
+  esp_sleep_enable_gpio_wakeup();
+  esp_sleep_enable_timer_wakeup(BUSY_SLEEP_LIMIT * 1000ULL);
+  esp_light_sleep_start();
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+  esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+  gpio_wakeup_disable((gpio_num_t)PANEL_BUSY_PIN);
+  busyEnd();
+}
+
+// Display has no virtual destructor: deleted as what newDisplay() made. The
+// panel driver is handed back, in the state init() left it in.
+template <uint16_t page_height>
+Panel deletePagedDisplay(Display *paged) {
+  GxEPD2_3C<Panel, page_height> *typed = static_cast<GxEPD2_3C<Panel, page_height> *>(paged);
+  Panel panel(typed->epd2);
+  delete typed;
+  return panel;
+}
+
+template <uint16_t page_height>
+Display *newDisplay(uint32_t available, uint32_t reserve, uint32_t block, BusyWait busyWait, const Panel &panel) {
+  typedef GxEPD2_3C<Panel, page_height> PagedDisplay;
+  if (sizeof(PagedDisplay) + DISPLAY_HEAP_RESERVE + reserve > available) return NULL;
+  PagedDisplay *created = new (std::nothrow) PagedDisplay(Panel(panel));
+  if (!created) return NULL;
+  // what is left has to be there, and not only in pieces
+  if (ESP.getFreeHeap() < DISPLAY_HEAP_RESERVE + reserve || ESP.getMaxAllocHeap() < block) {
+    delete created;
+    return NULL;
+  }
+  created->epd2.setBusyCallback(busyWait == BUSY_WAIT_LIGHT_SLEEP ? sleepWhileBusy : pollWhileBusy);
+  deleteDisplay = deletePagedDisplay<page_height>;
+  return created;
+}
+
+// The largest page buffer that fits with `reserve` bytes more left free,
+// `block` of them in one piece: the whole frame when the heap allows, which
+// it usually does once WiFi is off, else 1/2, 1/4 or 1/8 of it. Every page
+// replays the display list, so fewer pages is less work. `busyWait` is what
+// refreshes wait with, `panel` the driver the display gets a copy of.
+Display *createDisplay(uint32_t reserve, uint32_t block, BusyWait busyWait, const Panel &panel) {
+  uint32_t available = ESP.getMaxAllocHeap(); // the buffers are a single block
+  Display *created = newDisplay<Panel::HEIGHT>(available, reserve, block, busyWait, panel);
+  if (!created) created = newDisplay<Panel::HEIGHT / 2>(available, reserve, block, busyWait, panel);
+  if (!created) created = newDisplay<Panel::HEIGHT / 4>(available, reserve, block, busyWait, panel);
+  if (!created) created = newDisplay<Panel::HEIGHT / 8>(available, reserve, block, busyWait, panel);
+  return created;
+}
+
+// Creates the display and brings the panel out of reset, once per wake
+bool initDisplay(uint32_t reserve, uint32_t block) {
+  if (display) return true;
   Serial.println("Init display");
-  display.init(115200, true, 2, false);
-  if (dayChanged()) {
-    clearDisplay();
-    displaySunset();
-    displayDate();
-  }
-  displayWeather();
-  displayForecast();
+  spanBegin(STAGE_DISPLAY_INIT);
+  display = createDisplay(reserve, block, DISPLAY_BUSY_WAIT, Panel(16, PANEL_BUSY_PIN, 22, 17));
+  if (!display) {
+    spanEnd(STAGE_DISPLAY_INIT);
+    Serial.println(F("Not enough memory for the display"));
+    return false;
+  }
+  Serial.print(F("Page height: "));
+  Serial.println(display->pageHeight());
+  display->init(115200, true, 2, false);
+  spanEnd(STAGE_DISPLAY_INIT);
+  return true;
+}
+
+// Creates the display again with the largest page that fits now. The panel
+// driver moves over as it is, so the panel isn't reset and SPI not set up a
+// second time: only the page buffers are allocated again.
+bool growDisplay() {
+  if (display->pageHeight() == Panel::HEIGHT) return true;
+  spanBegin(STAGE_DISPLAY_INIT);
+  Panel panel = deleteDisplay(display);
+  // the freed page fits again at worst
+  display = createDisplay(0, 0, DISPLAY_BUSY_WAIT, panel);
+  spanEnd(STAGE_DISPLAY_INIT);
+  if (!display) {
+    Serial.println(F("Not enough memory for the display"));
+    return false;
+  }
+  Serial.print(F("Page height now: "));
+  Serial.println(display->pageHeight());
+  return true;
+}
+
+// Runs while the network task downloads the forecast: when the date or the
+// sunrise and sunset changed, the panel will be refreshed, so the display is
+// set up and those regions are recorded now. They only depend on the weather
+// part of `state`.
+void prepareDisplay() {
+  const RegionId early[] = {REGION_DATE, REGION_SUNSET};
+  uint8_t changed = 0;
+  for (size_t i = 0; i < sizeof(early) / sizeof(early[0]); i++) {
+    if (regionHash(early[i]) != regionHashes[early[i]]) {
+      changed |= 1 << early[i];
+    }
+  }
+  if (!changed) return;
+
+  // the network still needs its share of the heap, the page may be smaller
+  if (!initDisplay(NETWORK_HEAP_RESERVE, NETWORK_HEAP_BLOCK)) return;
+  display->setRotation(0);
+  recordRegions(changed);
+}
+
+void refreshDisplay() {
+  uint32_t hashes[REGION_COUNT];
+  uint8_t changed = 0;
+  for (int i = 0; i < REGION_COUNT; i++) {
+    hashes[i] = regionHash(i);
+    if (hashes[i] != regionHashes[i]) {
+      changed |= 1 << i;
+    }
+  }
+
+  // the last update time changes on every wake: it is redrawn along with
+  // the other regions but is no reason to refresh on its own
+  if ((changed & ~(1 << REGION_LAST_UPDATE)) == 0) {
+    Serial.println(F("Display unchanged, skipping refresh"));
+    return;
+  }
+  changed |= 1 << REGION_LAST_UPDATE;
+
+  // created by prepareDisplay() while the network held its share of the
+  // heap: with WiFi off there is room for bigger pages. The regions already
+  // recorded are kept, the display list doesn't depend on the page buffers.
+  if (display) {
+    if (!growDisplay()) return;
+  } else if (!initDisplay(0, 0)) {
+    return;
+  }
+
+  // a new day gets a full window refresh to clean the panel
+  bool newDay = changed & (1 << REGION_DATE);
+  if (newDay) {
+    Serial.println("day changed");
+  }
+  uint8_t drawn = composeFrame(changed, newDay);
   displayNextBus();
-  displayLastUpdate();
-  displayBattery();
-  display.hibernate();
+
+  spanBegin(STAGE_DISPLAY_HIBERNATE);
+  display->hibernate();
+  spanEnd(STAGE_DISPLAY_HIBERNATE);
+
+  for (int i = 0; i < REGION_COUNT; i++) {
+    if (drawn & (1 << i)) {
+      regionHashes[i] = hashes[i];
+    }
+  }
 }
 
 void loadSettings(Settings* settings) {
+  if (settingsCached) {
+    *settings = cachedSettings;
+    return;
+  }
+
+  if (!mountFs()) {
+    return;
+  }
   File file = LittleFS.open("/settings.json", "r");
   if (!file) {
     Serial.println(F("Failed to open settings"));
@@ -553,12 +1418,14 @@ void loadSettings(Settings* settings) {
   // Allocate a temporary JsonDocument
   // Don't forget to change the capacity to match your requirements.
   // Use arduinojson.org/v6/assistant to compute the capacity.
-  StaticJsonDocument<256> doc;
+  StaticJsonDocument<384> doc;
 
   // Deserialize the JSON document
   DeserializationError error = deserializeJson(doc, file);
   if (error)
     Serial.println(F("Failed to read file"));
+  else
+    settingsCached = true;
 
   // Copy values from the JsonDocument to the Config
   strlcpy(settings->ssid,          // <- destination
@@ -573,30 +1440,126 @@ void loadSettings(Settings* settings) {
   strlcpy(settings->OWApiKey,
           doc["OWApiKey"],
           sizeof(settings->OWApiKey));
+  strlcpy(settings->digestUrl,  // optional
+          doc["digestUrl"] | "",
+          sizeof(settings->digestUrl));
+  settings->quietStart = (doc["quietStart"] | 0) % 24;  // optional, none by default
+  settings->quietEnd = (doc["quietEnd"] | 0) % 24;
+
+  cachedSettings = *settings;
 
   // Close the file (Curiously, File's destructor doesn't close the file)
   file.close();
   Serial.println(F("Settings loaded"));
 }
 
+// Recalibrates the clock against NTP once in NTP_SYNC_INTERVAL; on the other
+// wakes it is set from the weather response, see setClockFromResponse()
 void setClock() {
+  if (lastNtpSync != 0 && time(NULL) - lastNtpSync < NTP_SYNC_INTERVAL) return;
+
   configTime(0, 0, "pool.ntp.org", "time.nist.gov");
   Serial.print(F("Waiting for NTP time sync: "));
-  struct tm timeinfo;
-  if (!getLocalTime(&timeinfo)) {
-    Serial.println("Failed to obtain time");
+  // getLocalTime() would return at once, the clock is already set
+  unsigned long start = millis();
+  while (sntp_get_sync_status() != SNTP_SYNC_STATUS_COMPLETED) {
+    // not fatal: the response set the clock
+    if (millis() - start > NTP_TIMEOUT) {
+      Serial.println("Failed to obtain time");
+      return;
+    }
+    delay(10);
   }
+  lastNtpSync = time(NULL);
+
+  struct tm timeinfo;
+  getLocalTime(&timeinfo);
   Serial.println(&timeinfo, "%A, %B %d %Y %H:%M:%S");
 }
 
-void connectToWifi(Settings *settings) {
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(settings->ssid, settings->password);
+// Seconds since the epoch of an RFC 7231 date ("Sun, 06 Nov 1994 08:49:37
+// GMT"), 0 when it doesn't parse
+time_t parseHttpDate(const char *date) {
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  int d, y, h, m, s;
+  char mon[4];
+  if (sscanf(date, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &d, mon, &y, &h, &m, &s) != 6) return 0;
+  const char *found = strstr(months, mon);
+  if (found == NULL || strlen(mon) != 3 || (found - months) % 3 != 0) return 0;
+  int mo = (found - months) / 3 + 1;
+
+  // days from civil, proleptic Gregorian calendar
+  y -= mo <= 2;
+  int era = y / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (mo > 2 ? mo - 3 : mo + 9) + 2) / 5 + d - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  long days = era * 146097L + doe - 719468;
+  return (time_t)days * SECS_PER_DAY + h * SECS_PER_HOUR + m * SECS_PER_MIN + s;
+}
 
+// Sets the clock from the Date header of a response, or when there is none
+// and the clock is behind, from the observation time of the data
+void setClockFromResponse(time_t date) {
+  if (date == 0) {
+    if ((time_t)state.dt <= time(NULL)) return;
+    date = state.dt;
+  }
+#ifdef ARDUINO_ARCH_ESP32
+  struct timeval tv = { date, 0 };
+  settimeofday(&tv, NULL);
+#endif  // the host keeps its own clock
+  Serial.print(F("Clock set from the response: "));
+  Serial.println((unsigned long)date);
+}
+
+// Waits up to `timeout` ms for the association, and the lease with DHCP
+bool waitForWifi(unsigned long timeout) {
+  unsigned long start = millis();
   while (WiFi.status() != WL_CONNECTED) {
-    delay(200);
-    Serial.print(F("."));
+    if (millis() - start >= timeout) return false;
+    delay(10);
   }
+  return true;
+}
+
+bool connectToWifi(Settings *settings) {
+  WiFi.mode(WIFI_STA);
+
+  // straight to the cached access point and channel, without a scan, and
+  // with the cached lease unless it is due for renewal
+  if (wifiCache.valid) {
+    uint32_t now = time(NULL);
+    bool renewLease = now < wifiCache.leasedAt || now - wifiCache.leasedAt >= WIFI_LEASE_RENEWAL;
+    if (!renewLease) {
+      WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway), IPAddress(wifiCache.subnet), IPAddress(wifiCache.dns));
+    }
+    WiFi.begin(settings->ssid, settings->password, wifiCache.channel, wifiCache.bssid);
+    if (waitForWifi(WIFI_FAST_CONNECT_TIMEOUT)) {
+      Serial.println(F("WiFi fast reconnect"));
+      if (!renewLease) return true;
+    } else {
+      Serial.println(F("WiFi fast reconnect failed, scanning"));
+      WiFi.disconnect();
+      WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE); // back to DHCP
+      wifiCache.valid = false;
+    }
+  }
+
+  if (!wifiCache.valid) {
+    WiFi.begin(settings->ssid, settings->password);
+    if (!waitForWifi(WIFI_CONNECT_TIMEOUT)) return false;
+  }
+
+  wifiCache.valid = true;
+  memcpy(wifiCache.bssid, WiFi.BSSID(), sizeof(wifiCache.bssid));
+  wifiCache.channel = WiFi.channel();
+  wifiCache.ip = WiFi.localIP();
+  wifiCache.gateway = WiFi.gatewayIP();
+  wifiCache.subnet = WiFi.subnetMask();
+  wifiCache.dns = WiFi.dnsIP(0);
+  wifiCache.leasedAt = time(NULL);
+  return true;
 }
 
 void disconnectWifi() {
@@ -604,85 +1567,545 @@ void disconnectWifi() {
   WiFi.mode(WIFI_OFF);
 }
 
-void refreshWeather(Settings *settings, WiFiClientSecure *client) {
+#ifdef ARDUINO_ARCH_ESP32
+int ResumingClientSecure::connect(const char *host, uint16_t port) {
+  int ret = handshake(host, port, true);
+  if (ret < 0 && tlsSession.length > 0) {
+    // a server that rejects the session answers with a full handshake, this
+    // is for anything else going wrong with it
+    Serial.println(F("TLS handshake with the saved session failed, retrying without"));
+    stop();
+    tlsSession.length = 0;
+    ret = handshake(host, port, false);
+  }
+  if (ret < 0) {
+    stop();
+    return 0;
+  }
+  _connected = true;
+  return 1;
+}
+
+// The steps of start_ssl_client() in the core, which has no way to set a
+// session before the handshake. Returns the socket, or < 0 on failure.
+int ResumingClientSecure::handshake(const char *host, uint16_t port, bool resume) {
+  IPAddress address;
+  if (!WiFi.hostByName(host, address)) return -1;
+
+  int fd = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  sslclient->socket = fd;
+  if (fd < 0) return -1;
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  struct sockaddr_in server;
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_addr.s_addr = (uint32_t)address;
+  server.sin_port = htons(port);
+  if (lwip_connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0 && errno != EINPROGRESS) return -1;
+  fd_set fdset;
+  FD_ZERO(&fdset);
+  FD_SET(fd, &fdset);
+  struct timeval timeout = { TLS_CONNECT_TIMEOUT / 1000, (TLS_CONNECT_TIMEOUT % 1000) * 1000 };
+  if (select(fd + 1, NULL, &fdset, NULL, &timeout) <= 0) return -1;
+  int error = 0;
+  socklen_t length = sizeof(error);
+  if (lwip_getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) return -1;
+  int enable = 1;
+  lwip_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  lwip_setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+
+  mbedtls_entropy_init(&sslclient->entropy_ctx);
+  if (mbedtls_ctr_drbg_seed(&sslclient->drbg_ctx, mbedtls_entropy_func, &sslclient->entropy_ctx, NULL, 0) != 0) return -1;
+  mbedtls_ssl_config *conf = &sslclient->ssl_conf;
+  if (mbedtls_ssl_config_defaults(conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0) return -1;
+  mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  if (arduino_esp_crt_bundle_attach(conf) != ESP_OK) return -1; // set by setCACertBundle()
+  mbedtls_ssl_conf_rng(conf, mbedtls_ctr_drbg_random, &sslclient->drbg_ctx);
+  mbedtls_ssl_conf_session_tickets(conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+  mbedtls_ssl_context *ssl = &sslclient->ssl_ctx;
+  if (mbedtls_ssl_setup(ssl, conf) != 0) return -1;
+  if (mbedtls_ssl_set_hostname(ssl, host) != 0) return -1;
+  mbedtls_ssl_set_bio(ssl, &sslclient->socket, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+  // offer the saved session, its ID comes back from the server when resumed
+  unsigned char offeredId[32];
+  size_t offeredIdLength = 0;
+  if (resume && tlsSession.length > 0) {
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_session_load(&session, tlsSession.data, tlsSession.length) == 0 &&
+        mbedtls_ssl_set_session(ssl, &session) == 0) {
+      offeredIdLength = session.id_len;
+      memcpy(offeredId, session.id, session.id_len);
+    }
+    mbedtls_ssl_session_free(&session);
+  }
+
+  unsigned long start = millis();
+  int ret;
+  while ((ret = mbedtls_ssl_handshake(ssl)) != 0) {
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) return ret;
+    if (millis() - start > TLS_HANDSHAKE_TIMEOUT) return -1;
+    delay(2);
+  }
+  if (mbedtls_ssl_get_verify_result(ssl) != 0) return -1;
+
+  mbedtls_ssl_session session;
+  mbedtls_ssl_session_init(&session);
+  if (mbedtls_ssl_get_session(ssl, &session) == 0) {
+    bool resumed = offeredIdLength > 0 && session.id_len == offeredIdLength &&
+                   memcmp(session.id, offeredId, offeredIdLength) == 0;
+    Serial.println(resumed ? F("TLS session resumed") : F("Full TLS handshake"));
+    size_t saved = 0;
+    if (mbedtls_ssl_session_save(&session, tlsSession.data, sizeof(tlsSession.data), &saved) != 0) {
+      Serial.println(F("TLS session too large to keep"));
+      saved = 0;
+    }
+    tlsSession.length = saved;
+  }
+  mbedtls_ssl_session_free(&session);
+  return fd;
+}
+#else
+int ResumingClientSecure::connect(const char *host, uint16_t port) {
+  return WiFiClientSecure::connect(host, port);
+}
+#endif
+
+HttpBodyStream::HttpBodyStream(Stream &stream, bool chunked, int size)
+  : _stream(stream), _chunked(chunked), _remaining(chunked ? 0 : size) {
+}
+
+int HttpBodyStream::available() {
+  if (_peeked >= 0) return 1;
+  if (_end) return 0;
+  int available = _stream.available();
+  return (!_chunked && _remaining >= 0) ? min((long)available, _remaining) : available;
+}
+
+int HttpBodyStream::read() {
+  if (_peeked >= 0) {
+    int c = _peeked;
+    _peeked = -1;
+    return c;
+  }
+  if (_end) return -1;
+  if (_chunked && _remaining == 0 && !nextChunk()) return -1;
+  if (_remaining == 0) {
+    _end = true; // Content-Length reached
+    return -1;
+  }
+  int c = readRaw();
+  if (c < 0) {
+    _end = true;
+    return -1;
+  }
+  if (_remaining > 0) _remaining--;
+  return c;
+}
+
+int HttpBodyStream::peek() {
+  if (_peeked < 0) _peeked = read();
+  return _peeked;
+}
+
+// Reads what the parser left of the body, the next response starts after it
+void HttpBodyStream::drain() {
+  while (read() >= 0) {}
+}
+
+// with the stream timeout, the bytes may still be on their way
+int HttpBodyStream::readRaw() {
+  uint8_t c;
+  return _stream.readBytes(&c, 1) == 1 ? c : -1;
+}
+
+// Reads a CRLF terminated line, truncated to `size`
+bool HttpBodyStream::readLine(char *line, size_t size) {
+  size_t length = 0;
+  int c;
+  while ((c = readRaw()) >= 0 && c != '\n') {
+    if (c != '\r' && length + 1 < size) line[length++] = c;
+  }
+  line[length] = '\0';
+  return c == '\n';
+}
+
+// Reads the size line of the next chunk, after the CRLF ending the previous
+// one. The last chunk (size 0) and the trailer after it end the body.
+bool HttpBodyStream::nextChunk() {
+  char line[32];
+  do {
+    if (!readLine(line, sizeof(line))) {
+      _end = true;
+      return false;
+    }
+  } while (line[0] == '\0');
+  _remaining = strtol(line, NULL, 16); // any ;extension is ignored
+  if (_remaining <= 0) {
+    while (readLine(line, sizeof(line)) && line[0] != '\0') {} // trailer
+    _end = true;
+    return false;
+  }
+  return true;
+}
+
+// The response body of the last GET on `http`, read up to its end by the
+// caller so the connection can be reused
+HttpBodyStream responseBody(HTTPClient *http) {
+  bool chunked = http->header("Transfer-Encoding").equalsIgnoreCase("chunked");
+  return HttpBodyStream(http->getStream(), chunked, http->getSize());
+}
+
+// Asks for a gzip body. For HTTP/1.1 the HTTPClient sends an Accept-Encoding
+// of its own, and the server reads the first one, so it is replaced with
+// setAcceptEncoding() rather than added to. Cores without it keep asking for
+// identity, and get the body as it is.
+template <typename Client>
+static auto acceptGzip(Client *http, int) -> decltype(http->setAcceptEncoding(String()), void()) {
+  http->setAcceptEncoding("gzip");
+}
+
+template <typename Client>
+static void acceptGzip(Client *http, long) {}
+
+bool gzipped(HTTPClient *http) {
+  return http->header("Content-Encoding").equalsIgnoreCase("gzip");
+}
+
+InflateStream::~InflateStream() {
+  free(_decompressor);
+  free(_dict);
+  free(_input);
+}
+
+int InflateStream::available() {
+  if (_outputPos < _outputLength) return _outputLength - _outputPos;
+  return _end ? 0 : _source.available() > 0;
+}
+
+int InflateStream::read() {
+  if (!fill()) return -1;
+  return _dict[_outputPos++];
+}
+
+int InflateStream::peek() {
+  if (!fill()) return -1;
+  return _dict[_outputPos];
+}
+
+bool InflateStream::begin() {
+  _started = true;
+  _decompressor = (tinfl_decompressor *)malloc(sizeof(tinfl_decompressor));
+  _dict = (uint8_t *)malloc(TINFL_LZ_DICT_SIZE);
+  _input = (uint8_t *)malloc(INFLATE_INPUT_SIZE);
+  if (_decompressor == NULL || _dict == NULL || _input == NULL) {
+    Serial.println(F("No memory to inflate the response"));
+    return false;
+  }
+  if (!skipHeader()) {
+    Serial.println(F("Not a gzip response"));
+    return false;
+  }
+  tinfl_init(_decompressor);
+  return true;
+}
+
+// The gzip header (RFC 1952) before the deflate data. The trailer is left
+// unread: TLS already checks the bytes, the JSON parser the content.
+bool InflateStream::skipHeader() {
+  uint8_t header[10];
+  for (size_t i = 0; i < sizeof(header); i++) {
+    int c = _source.read();
+    if (c < 0) return false;
+    header[i] = c;
+  }
+  if (header[0] != 0x1f || header[1] != 0x8b || header[2] != 8) return false;
+  uint8_t flags = header[3];
+  if (flags & 0x04) {  // FEXTRA
+    int low = _source.read();
+    int high = _source.read();
+    if (low < 0 || high < 0) return false;
+    for (int length = low | (high << 8); length > 0; length--) {
+      if (_source.read() < 0) return false;
+    }
+  }
+  for (uint8_t flag = 0x08; flag <= 0x10; flag <<= 1) {  // FNAME, FCOMMENT
+    if (!(flags & flag)) continue;
+    int c;
+    while ((c = _source.read()) > 0) {}
+    if (c < 0) return false;
+  }
+  if (flags & 0x02) {  // FHCRC
+    if (_source.read() < 0 || _source.read() < 0) return false;
+  }
+  return true;
+}
+
+// Inflates until there is output to read, false at the end of the data
+bool InflateStream::fill() {
+  if (!_started && !begin()) _end = true;
+  while (_outputPos == _outputLength) {
+    if (_end) return false;
+
+    if (_inputPos == _inputLength && !_sourceEnd) {
+      // wait for one byte, then take what has already arrived
+      _inputPos = 0;
+      _inputLength = 0;
+      int c = _source.read();
+      while (c >= 0) {
+        _input[_inputLength++] = c;
+        if (_inputLength == INFLATE_INPUT_SIZE || _source.available() <= 0) break;
+        c = _source.read();
+      }
+      if (c < 0) _sourceEnd = true;
+    }
+
+    size_t inputSize = _inputLength - _inputPos;
+    size_t outputSize = TINFL_LZ_DICT_SIZE - _dictPos;
+    tinfl_status status = tinfl_decompress(_decompressor, _input + _inputPos, &inputSize,
+                                           _dict, _dict + _dictPos, &outputSize,
+                                           _sourceEnd ? 0 : TINFL_FLAG_HAS_MORE_INPUT);
+    _inputPos += inputSize;
+    _outputPos = _dictPos;
+    _outputLength = _dictPos + outputSize;
+    _dictPos = (_dictPos + outputSize) & (TINFL_LZ_DICT_SIZE - 1);
+
+    if (status == TINFL_STATUS_DONE) {
+      _end = true;
+    } else if (status < 0 || (status == TINFL_STATUS_NEEDS_MORE_INPUT && _sourceEnd)) {
+      Serial.println(F("Invalid gzip response"));
+      _end = true;
+    }
+  }
+  return true;
+}
+
+bool refreshWeather(Settings *settings, WiFiClientSecure *client, HTTPClient *http) {
   char url[128];
   snprintf(url, 128, openWeatherApi, weatherEndpoint, settings->OWLocation, settings->OWApiKey, "");
   Serial.println(url);
 
-  HTTPClient http;
-  http.begin(dynamic_cast<WiFiClient&>(*client), url);
-  http.useHTTP10(true);
-  int httpCode = http.GET();
+  http->begin(dynamic_cast<WiFiClient&>(*client), url);
+  acceptGzip(http, 0);
+  int httpCode = http->GET();
+  if (httpCode != HTTP_CODE_OK) {
+    Serial.print(F("Weather request failed: "));
+    Serial.println(httpCode);
+    http->end();
+    return false;
+  }
+  time_t date = parseHttpDate(http->header("Date").c_str());
+
+  float temp = 0;
+  long sunriseUtc = 0;
+  long sunsetUtc = 0;
+  const JsonField fields[] = {
+    {"dt", JSON_LONG, &state.dt, 0},
+    {"timezone", JSON_INT, &state.offset, 0},
+    {"main.temp", JSON_FLOAT, &temp, 0},
+    {"weather[0].icon", JSON_STRING, state.currentWeather, sizeof(state.currentWeather)},
+    {"sys.sunrise", JSON_LONG, &sunriseUtc, 0},
+    {"sys.sunset", JSON_LONG, &sunsetUtc, 0},
+  };
 
-  StaticJsonDocument<1024> doc;
-  deserializeJson(doc, http.getStream());
+  HttpBodyStream body = responseBody(http);
+  InflateStream inflated(body);
+  Stream &json = gzipped(http) ? (Stream &)inflated : body;
+  bool parsed = extractJson(json, fields, sizeof(fields) / sizeof(fields[0]));
+  body.drain();
+  http->end();
+  if (!parsed) {
+    Serial.println(F("Invalid weather response"));
+    return false;
+  }
 
-  state.dt = doc["dt"];
-  state.offset = doc["timezone"];
-  state.currentTemp = round((float)doc["main"]["temp"]);
-  strcpy(state.currentWeather, doc["weather"][0]["icon"]);
-  unsigned int sunrise = (int)(doc["sys"]["sunrise"]) + (int)(doc["timezone"]);
-  unsigned int sunset = (int)(doc["sys"]["sunset"]) + (int)(doc["timezone"]);
+  state.currentTemp = round(temp);
+  unsigned int sunrise = sunriseUtc + state.offset;
+  unsigned int sunset = sunsetUtc + state.offset;
 
   snprintf(state.todaySunrise, 6, "%02d:%02d", hour(sunrise), minute(sunrise));
   snprintf(state.todaySunset, 6, "%02d:%02d", hour(sunset), minute(sunset));
+
+  setClockFromResponse(date);
+  publishState(STATE_WEATHER);
+  return true;
 }
 
-void refreshForecast(Settings *settings, WiFiClientSecure *client) {
+bool refreshForecast(Settings *settings, WiFiClientSecure *client, HTTPClient *http) {
+  unsigned long currentTime = state.dt + state.offset;
+
+  // only the slots up to the afternoon of the third day after today, plus
+  // one in case the first slot already started
+  unsigned long lastSlot = currentTime - currentTime % SECS_PER_DAY + 3 * SECS_PER_DAY + 19 * SECS_PER_HOUR;
+  int cnt = min((int)((lastSlot - currentTime) / (3 * SECS_PER_HOUR)) + 2, FORECAST_MAX_COUNT);
+  char count[10];
+  snprintf(count, sizeof(count), "&cnt=%d", cnt);
+
   char url[132];
-  snprintf(url, 132, openWeatherApi, forecastEndpoint, settings->OWLocation, settings->OWApiKey, "&cnt=30");
+  snprintf(url, 132, openWeatherApi, forecastEndpoint, settings->OWLocation, settings->OWApiKey, count);
   Serial.println(url);
 
-  HTTPClient http;
-  http.begin(dynamic_cast<WiFiClient&>(*client), url);
-  http.useHTTP10(true);
-  int httpCode = http.GET();
+  http->begin(dynamic_cast<WiFiClient&>(*client), url);
+  acceptGzip(http, 0);
+  int httpCode = http->GET();
   Serial.println(httpCode);
+  if (httpCode != HTTP_CODE_OK) {
+    http->end();
+    return false;
+  }
 
-  DynamicJsonDocument doc(4096);  // https://arduinojson.org/v6/assistant/
-  StaticJsonDocument<160> filter;
-  filter["city"]["timezone"] = true;
-
-  JsonObject filter_list_0 = filter["list"].createNestedObject();
-  filter_list_0["dt"] = true;
-  filter_list_0["main"]["temp"] = true;
-  filter_list_0["weather"][0]["icon"] = true;
+  // the list entries are parsed one at a time as they arrive, straight into
+  // the fields below
+  HttpBodyStream body = responseBody(http);
+  InflateStream inflated(body);
+  Stream &json = gzipped(http) ? (Stream &)inflated : body;
+  if (!json.find("\"list\":[")) {
+    Serial.println(F("No forecast list"));
+    http->end();
+    return false;
+  }
 
-  DeserializationError error = deserializeJson(doc, http.getStream(), DeserializationOption::Filter(filter));
-  if (error)
-    Serial.println(error.f_str());
+  long dt;
+  int temp;
+  char icon[4];
+  const JsonField fields[] = {
+    {"dt", JSON_LONG, &dt, 0},
+    {"main.temp", JSON_INT, &temp, 0},
+    {"weather[0].icon", JSON_STRING, icon, sizeof(icon)},
+  };
 
   int dayIndex = 0;
+  int index = 0;
+  do {
+    dt = 0;
+    temp = 0;
+    icon[0] = '\0';
+    if (!extractJson(json, fields, sizeof(fields) / sizeof(fields[0]))) {
+      Serial.println(F("Invalid forecast response"));
+      http->end();
+      return false;
+    }
 
-  int offset = doc["city"]["timezone"];
-  unsigned int currentTime = state.dt + state.offset;
-
-  state.laterTime = (int)doc["list"][1]["dt"] + offset;
-  state.laterTemp = doc["list"][1]["main"]["temp"];
-  strcpy(state.laterWeather, doc["list"][1]["weather"][0]["icon"]);
+    unsigned long t = dt + state.offset;
+    if (index == 0) {
+      forecastCache.expires = dt;
+    } else if (index == 1) {
+      state.laterTime = t;
+      state.laterTemp = temp;
+      strcpy(state.laterWeather, icon);
+    }
+    index++;
 
-  for (JsonObject list_item : doc["list"].as<JsonArray>()) {
-    unsigned long t = ((int)list_item["dt"]) + offset;
     if ((hour(t) >= 7 && hour(t) < 10) || (hour(t) >= 16 && hour(t) < 19)) {
       if (day(t) != day(currentTime)) {
         if (strcmp(state.forecast[dayIndex].morningWeather, "") == 0) {
           toWeekdayStr(state.forecast[dayIndex].day, weekday(t));
-          state.forecast[dayIndex].morningTemp = list_item["main"]["temp"];
-          strcpy(state.forecast[dayIndex].morningWeather, list_item["weather"][0]["icon"]);
+          state.forecast[dayIndex].morningTemp = temp;
+          strcpy(state.forecast[dayIndex].morningWeather, icon);
         } else {
-          state.forecast[dayIndex].afternoonTemp = list_item["main"]["temp"];
-          strcpy(state.forecast[dayIndex].afternoonWeather, list_item["weather"][0]["icon"]);
+          state.forecast[dayIndex].afternoonTemp = temp;
+          strcpy(state.forecast[dayIndex].afternoonWeather, icon);
           dayIndex++;
-          if (dayIndex >= 3) {
-            break;
-          }
         }
       }
     }
+  } while (dayIndex < 3 && json.findUntil(",", "]"));
+
+  if (dayIndex >= 3) {
+    // the rest of the response isn't needed, and this is the last request
+    Serial.print(F("Forecast complete after "));
+    Serial.print(index);
+    Serial.println(F(" entries, closing the connection"));
+    client->stop();
+  } else {
+    body.drain();
   }
+  http->end();
+
+  forecastCache.valid = true;
+  forecastCache.day = day(currentTime);
+  forecastCache.laterTime = state.laterTime;
+  forecastCache.laterTemp = state.laterTemp;
+  strcpy(forecastCache.laterWeather, state.laterWeather);
+  memcpy(forecastCache.forecast, state.forecast, sizeof(state.forecast));
+  return true;
 }
 
-static const uint16_t input_buffer_pixels = 800; // may affect performance
+// Whether a new slot was published or the day changed since the forecast was
+// downloaded, by the time of the weather just fetched
+bool forecastExpired() {
+  unsigned long currentTime = state.dt + state.offset;
+  return !forecastCache.valid || state.dt >= forecastCache.expires || day(currentTime) != forecastCache.day;
+}
+
+void restoreForecast() {
+  Serial.println(F("Forecast from the cache"));
+  state.laterTime = forecastCache.laterTime;
+  state.laterTemp = forecastCache.laterTemp;
+  strcpy(state.laterWeather, forecastCache.laterWeather);
+  memcpy(state.forecast, forecastCache.forecast, sizeof(state.forecast));
+}
+
+// Binary search of the atlas index (sorted by name, see tools/pack_icons.py).
+// The atlas is embedded with no alignment: headers and index entries are
+// copied out before their fields are read.
+const uint8_t *findIcon(const char *name)
+{
+  IconAtlasHeader atlas;
+  memcpy(&atlas, icons_atlas_start, sizeof(atlas));
+  if (atlas.magic != ICON_ATLAS_MAGIC) return NULL;
+  const uint8_t *index = icons_atlas_start + sizeof(atlas);
+  int lo = 0;
+  int hi = atlas.count - 1;
+  while (lo <= hi)
+  {
+    int mid = (lo + hi) / 2;
+    IconAtlasEntry entry;
+    memcpy(&entry, index + mid * sizeof(entry), sizeof(entry));
+    int cmp = strncmp(name, entry.name, sizeof(entry.name));
+    if (cmp == 0) return icons_atlas_start + entry.offset;
+    if (cmp < 0) hi = mid - 1;
+    else lo = mid + 1;
+  }
+  return NULL;
+}
+
+// Records both planes of the packed icon at `data`, drawn straight from the
+// memory-mapped flash
+bool drawPackedIcon(const uint8_t *data, int16_t x, int16_t y)
+{
+  PackedIconHeader icon;
+  memcpy(&icon, data, sizeof(icon));
+  if (icon.magic != PACKED_ICON_MAGIC)
+  {
+    Serial.println(F("not a packed icon"));
+    return false;
+  }
+  if ((x + icon.width) > Panel::WIDTH || (y + icon.height) > Panel::HEIGHT)
+  {
+    Serial.println(F("packed icon out of screen"));
+    return false;
+  }
+  const uint8_t *black = data + sizeof(icon);
+  const uint8_t *color = NULL; // no plane: left white
+  if (icon.flags & PACKED_ICON_COLOR) color = black + (icon.width + 7) / 8 * icon.height;
+  frame.drawImage(black, color, x, y, icon.width, icon.height);
+  return true;
+}
+
+// Draws icon <name> from the atlas, or /<name>.bmp when it isn't in there
+void drawIcon(const char *name, int16_t x, int16_t y)
+{
+  const uint8_t *icon = findIcon(name);
+  if (icon && drawPackedIcon(icon, x, y)) return;
+
+  char filename[24];
+  snprintf(filename, sizeof(filename), "%s.bmp", name);
+  drawBitmapFromSpiffs(filename, x, y, false);
+}
+
+static const uint16_t input_buffer_pixels = 800; // may affect performance, multiple of 8
 
 static const uint16_t max_row_width = 1872; // for up to 7.8" display 1872x1404
 static const uint16_t max_palette_pixels = 256; // for depth <= 8
@@ -694,24 +2117,154 @@ uint8_t mono_palette_buffer[max_palette_pixels / 8]; // palette buffer for depth
 uint8_t color_palette_buffer[max_palette_pixels / 8]; // palette buffer for depth <= 8 c/w
 uint16_t rgb_palette_buffer[max_palette_pixels]; // palette buffer for depth <= 8 for buffered graphics, needed for 7-color display
 
-uint16_t read16(fs::File& f)
+static const uint16_t bmp_header_block = BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + 4 * max_palette_pixels;
+
+// Decodes `count` pixels of a BMP row into the output row buffers, starting
+// at column `col` (a multiple of 8). The rows start out white, only black and
+// colored pixels are written.
+typedef void (*BmpRowKernel)(const uint8_t *in, uint16_t col, uint16_t count, bool with_color, uint32_t format);
+
+static inline void plotBmpPixel(uint16_t col, bool whitish, bool colored, bool with_color)
+{
+  if (whitish)
+  {
+    // keep white
+  }
+  else if (colored && with_color)
+  {
+    output_row_color_buffer[col / 8] &= ~(0x80 >> col % 8); // colored
+  }
+  else
+  {
+    output_row_mono_buffer[col / 8] &= ~(0x80 >> col % 8); // black
+  }
+}
+
+static inline void plotBmpRgb(uint16_t col, uint16_t red, uint16_t green, uint16_t blue, bool with_color)
+{
+  bool whitish = with_color ? ((red > 0x80) && (green > 0x80) && (blue > 0x80)) : ((red + green + blue) > 3 * 0x80); // whitish
+  bool colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0)); // reddish or yellowish?
+  plotBmpPixel(col, whitish, colored, with_color);
+}
+
+// palette depths, 4 and 8 bpp
+template <uint8_t depth>
+void decodeBmpRow(const uint8_t *in, uint16_t col, uint16_t count, bool with_color, uint32_t format)
+{
+  const uint8_t bitmask = (1 << depth) - 1;
+  for (uint16_t i = 0; i < count; i++, col++)
+  {
+    uint16_t bit = i * depth;
+    uint16_t pn = (in[bit / 8] >> (8 - depth - bit % 8)) & bitmask;
+    plotBmpPixel(col, mono_palette_buffer[pn / 8] & (0x1 << pn % 8), color_palette_buffer[pn / 8] & (0x1 << pn % 8), with_color);
+  }
+}
+
+// 1 bpp has no color and two palette entries, so a whole input byte maps to
+// an output byte: bits of whitish entries set, the others cleared
+template <>
+void decodeBmpRow<1>(const uint8_t *in, uint16_t col, uint16_t count, bool with_color, uint32_t format)
 {
-  // BMP data is stored little-endian, same as Arduino.
-  uint16_t result;
-  ((uint8_t *)&result)[0] = f.read(); // LSB
-  ((uint8_t *)&result)[1] = f.read(); // MSB
-  return result;
+  const uint8_t white0 = (mono_palette_buffer[0] & 0x1) ? 0xFF : 0x00;
+  const uint8_t white1 = (mono_palette_buffer[0] & 0x2) ? 0xFF : 0x00;
+  uint8_t *out = output_row_mono_buffer + col / 8;
+  uint16_t bytes = (count + 7) / 8;
+  for (uint16_t i = 0; i < bytes; i++)
+  {
+    out[i] = (in[i] & white1) | (~in[i] & white0);
+  }
+  if (count % 8) out[bytes - 1] |= 0xFF >> (count % 8); // white (for w%8!=0 border)
 }
 
-uint32_t read32(fs::File& f)
+template <>
+void decodeBmpRow<16>(const uint8_t *in, uint16_t col, uint16_t count, bool with_color, uint32_t format)
 {
-  // BMP data is stored little-endian, same as Arduino.
-  uint32_t result;
-  ((uint8_t *)&result)[0] = f.read(); // LSB
-  ((uint8_t *)&result)[1] = f.read();
-  ((uint8_t *)&result)[2] = f.read();
-  ((uint8_t *)&result)[3] = f.read(); // MSB
-  return result;
+  const uint8_t *end = in + 2 * count;
+  if (format == 0) // 555
+  {
+    for (; in < end; in += 2, col++)
+    {
+      plotBmpRgb(col, (in[1] & 0x7C) << 1, ((in[1] & 0x03) << 6) | ((in[0] & 0xE0) >> 2), (in[0] & 0x1F) << 3, with_color);
+    }
+  }
+  else // 565
+  {
+    for (; in < end; in += 2, col++)
+    {
+      plotBmpRgb(col, in[1] & 0xF8, ((in[1] & 0x07) << 5) | ((in[0] & 0xE0) >> 3), (in[0] & 0x1F) << 3, with_color);
+    }
+  }
+}
+
+template <>
+void decodeBmpRow<24>(const uint8_t *in, uint16_t col, uint16_t count, bool with_color, uint32_t format)
+{
+  const uint8_t *end = in + 3 * count;
+  for (; in < end; in += 3, col++)
+  {
+    plotBmpRgb(col, in[2], in[1], in[0], with_color);
+  }
+}
+
+BmpRowKernel bmpRowKernel(uint16_t depth)
+{
+  switch (depth)
+  {
+    case 1: return decodeBmpRow<1>;
+    case 4: return decodeBmpRow<4>;
+    case 8: return decodeBmpRow<8>;
+    case 16: return decodeBmpRow<16>;
+    case 24: return decodeBmpRow<24>;
+  }
+  return NULL;
+}
+
+// Parses the file and info headers from the first `length` bytes of a BMP
+// file of `fileSize` bytes. Fails when the file is truncated or the header
+// is inconsistent, so a damaged icon is never drawn as garbage.
+bool parseBmpHeader(const uint8_t *data, size_t length, size_t fileSize, BmpHeader *bmp)
+{
+  if (length < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE || le16(data) != BMP_SIGNATURE)
+  {
+    Serial.println(F("not a bitmap or truncated header"));
+    return false;
+  }
+  bmp->fileSize = le32(data + 2);
+  bmp->imageOffset = le32(data + 10);
+  bmp->headerSize = le32(data + 14);
+  bmp->width = (int32_t)le32(data + 18);
+  bmp->height = (int32_t)le32(data + 22);
+  bmp->planes = le16(data + 26);
+  bmp->depth = le16(data + 28);
+  bmp->format = le32(data + 30);
+
+  if ((bmp->planes != 1) || ((bmp->format != 0) && (bmp->format != 3)) || !bmpRowKernel(bmp->depth)) // uncompressed is handled, 565 also
+  {
+    Serial.println(F("compression or bit depth not handled"));
+    return false;
+  }
+  if ((bmp->width <= 0) || (bmp->width > 0xFFFF) || (bmp->height == 0) || (bmp->height < -0xFFFF) || (bmp->height > 0xFFFF))
+  {
+    Serial.println(F("bad bitmap size"));
+    return false;
+  }
+  uint32_t dataStart = BMP_FILE_HEADER_SIZE + bmp->headerSize;
+  if (bmp->depth <= 8) dataStart += 4 << bmp->depth;
+  if ((bmp->headerSize < BMP_INFO_HEADER_SIZE) || (bmp->imageOffset < dataStart))
+  {
+    Serial.println(F("bad bitmap header size or image offset"));
+    return false;
+  }
+  bmp->paletteOffset = bmp->imageOffset - (bmp->depth <= 8 ? 4 << bmp->depth : 0);
+  // BMP rows are padded (if needed) to 4-byte boundary
+  bmp->rowSize = ((bmp->width * bmp->depth + 31) / 32) * 4;
+  uint32_t rows = bmp->height < 0 ? -bmp->height : bmp->height;
+  if (bmp->imageOffset > fileSize || (fileSize - bmp->imageOffset) / bmp->rowSize < rows)
+  {
+    Serial.println(F("truncated bitmap"));
+    return false;
+  }
+  return true;
 }
 
 void drawBitmapFromSpiffs(const char *filename, int16_t x, int16_t y, bool with_color)
@@ -720,7 +2273,8 @@ void drawBitmapFromSpiffs(const char *filename, int16_t x, int16_t y, bool with_
   bool valid = false; // valid format to be handled
   bool flip = true; // bitmap is stored bottom-to-top
   uint32_t startTime = millis();
-  if ((x >= display.epd2.WIDTH) || (y >= display.epd2.HEIGHT)) return;
+  if ((x >= Panel::WIDTH) || (y >= Panel::HEIGHT)) return;
+  if (!mountFs()) return;
   Serial.println();
   Serial.print(F("Loading image '"));
   Serial.print(filename);
@@ -731,158 +2285,83 @@ void drawBitmapFromSpiffs(const char *filename, int16_t x, int16_t y, bool with_
     Serial.print(F("File not found"));
     return;
   }
-  // Parse BMP header
-  if (read16(file) == 0x4D42) // BMP signature
+  // the file header, the info header and the palette in a single read
+  size_t headerBytes = file.read(input_buffer, bmp_header_block);
+  BmpHeader bmp;
+  if (parseBmpHeader(input_buffer, headerBytes, file.size(), &bmp))
   {
-    uint32_t fileSize = read32(file);
-    uint32_t creatorBytes = read32(file); (void)creatorBytes; //unused
-    uint32_t imageOffset = read32(file); // Start of image data
-    uint32_t headerSize = read32(file);
-    uint32_t width  = read32(file);
-    int32_t height = (int32_t) read32(file);
-    uint16_t planes = read16(file);
-    uint16_t depth = read16(file); // bits per pixel
-    uint32_t format = read32(file);
-    if ((planes == 1) && ((format == 0) || (format == 3))) // uncompressed is handled, 565 also
+    BmpRowKernel kernel = bmpRowKernel(bmp.depth); // selected once for the whole image
+    uint16_t depth = bmp.depth;
+    uint32_t format = bmp.format;
+    uint32_t rowSize = bmp.rowSize;
+    int32_t height = bmp.height;
+    Serial.print(F("File size: ")); Serial.println(bmp.fileSize);
+    Serial.print(F("Image Offset: ")); Serial.println(bmp.imageOffset);
+    Serial.print(F("Header size: ")); Serial.println(bmp.headerSize);
+    Serial.print(F("Bit Depth: ")); Serial.println(depth);
+    Serial.print(F("Image size: "));
+    Serial.print(bmp.width);
+    Serial.print('x');
+    Serial.println(height);
+    if (height < 0)
     {
-      Serial.print(F("File size: ")); Serial.println(fileSize);
-      Serial.print(F("Image Offset: ")); Serial.println(imageOffset);
-      Serial.print(F("Header size: ")); Serial.println(headerSize);
-      Serial.print(F("Bit Depth: ")); Serial.println(depth);
-      Serial.print(F("Image size: "));
-      Serial.print(width);
-      Serial.print('x');
-      Serial.println(height);
-      // BMP rows are padded (if needed) to 4-byte boundary
-      uint32_t rowSize = (width * depth / 8 + 3) & ~3;
-      if (depth < 8) rowSize = ((width * depth + 8 - depth) / 8 + 3) & ~3;
-      if (height < 0)
-      {
-        height = -height;
-        flip = false;
-      }
-      uint16_t w = width;
-      uint16_t h = height;
-      if ((x + w - 1) >= display.epd2.WIDTH)  w = display.epd2.WIDTH  - x;
-      if ((y + h - 1) >= display.epd2.HEIGHT) h = display.epd2.HEIGHT - y;
-      if (w <= max_row_width) // handle with direct drawing
+      height = -height;
+      flip = false;
+    }
+    uint16_t w = bmp.width;
+    uint16_t h = height;
+    if ((x + w - 1) >= Panel::WIDTH)  w = Panel::WIDTH  - x;
+    if ((y + h - 1) >= Panel::HEIGHT) h = Panel::HEIGHT - y;
+    if (w <= max_row_width) // handle with direct drawing
+    {
+      valid = true;
+      if (depth == 1) with_color = false;
+      if (depth <= 8)
       {
-        valid = true;
-        uint8_t bitmask = 0xFF;
-        uint8_t bitshift = 8 - depth;
-        uint16_t red, green, blue;
-        bool whitish = false;
-        bool colored = false;
-        if (depth == 1) with_color = false;
-        if (depth <= 8)
+        uint16_t paletteBytes = 4 << depth;
+        const uint8_t *palette = input_buffer + bmp.paletteOffset;
+        if (bmp.paletteOffset + paletteBytes > headerBytes) // larger header or a gap before the palette
         {
-          if (depth < 8) bitmask >>= depth;
-          //file.seek(54); //palette is always @ 54
-          file.seek(imageOffset - (4 << depth)); // 54 for regular, diff for colorsimportant
-          for (uint16_t pn = 0; pn < (1 << depth); pn++)
-          {
-            blue  = file.read();
-            green = file.read();
-            red   = file.read();
-            file.read();
-            whitish = with_color ? ((red > 0x80) && (green > 0x80) && (blue > 0x80)) : ((red + green + blue) > 3 * 0x80); // whitish
-            colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0)); // reddish or yellowish?
-            if (0 == pn % 8) mono_palette_buffer[pn / 8] = 0;
-            mono_palette_buffer[pn / 8] |= whitish << pn % 8;
-            if (0 == pn % 8) color_palette_buffer[pn / 8] = 0;
-            color_palette_buffer[pn / 8] |= colored << pn % 8;
-          }
+          file.seek(bmp.paletteOffset);
+          valid = file.read(input_buffer, paletteBytes) == paletteBytes;
+          palette = input_buffer;
+        }
+        for (uint16_t pn = 0; valid && pn < (1 << depth); pn++, palette += 4)
+        {
+          uint16_t blue = palette[0], green = palette[1], red = palette[2];
+          bool whitish = with_color ? ((red > 0x80) && (green > 0x80) && (blue > 0x80)) : ((red + green + blue) > 3 * 0x80); // whitish
+          bool colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0)); // reddish or yellowish?
+          if (0 == pn % 8) mono_palette_buffer[pn / 8] = 0;
+          mono_palette_buffer[pn / 8] |= whitish << pn % 8;
+          if (0 == pn % 8) color_palette_buffer[pn / 8] = 0;
+          color_palette_buffer[pn / 8] |= colored << pn % 8;
         }
-        uint32_t rowPosition = flip ? imageOffset + (height - h) * rowSize : imageOffset;
+      }
+      // decoded once into the display list, then replayed on every page
+      uint8_t *black = valid ? frame.allocImage(w, h, with_color) : NULL;
+      uint16_t rowBytes = (w + 7) / 8;
+      uint8_t *color = with_color && black ? black + rowBytes * h : NULL;
+      valid = black != NULL;
+      if (valid)
+      {
+        uint32_t rowPosition = flip ? bmp.imageOffset + (height - h) * rowSize : bmp.imageOffset;
         for (uint16_t row = 0; row < h; row++, rowPosition += rowSize) // for each line
         {
-          uint32_t in_remain = rowSize;
-          uint32_t in_idx = 0;
-          uint32_t in_bytes = 0;
-          uint8_t in_byte = 0; // for depth <= 8
-          uint8_t in_bits = 0; // for depth <= 8
-          uint8_t out_byte = 0xFF; // white (for w%8!=0 border)
-          uint8_t out_color_byte = 0xFF; // white (for w%8!=0 border)
-          uint32_t out_idx = 0;
+          memset(output_row_mono_buffer, 0xFF, rowBytes); // white
+          memset(output_row_color_buffer, 0xFF, rowBytes); // white
           file.seek(rowPosition);
-          for (uint16_t col = 0; col < w; col++) // for each pixel
+          for (uint16_t col = 0; col < w; col += input_buffer_pixels) // for each chunk of pixels
           {
-            // Time to read more pixel data?
-            if (in_idx >= in_bytes) // ok, exact match for 24bit also (size IS multiple of 3)
-            {
-              in_bytes = file.read(input_buffer, in_remain > sizeof(input_buffer) ? sizeof(input_buffer) : in_remain);
-              in_remain -= in_bytes;
-              in_idx = 0;
-            }
-            switch (depth)
-            {
-              case 24:
-                blue = input_buffer[in_idx++];
-                green = input_buffer[in_idx++];
-                red = input_buffer[in_idx++];
-                whitish = with_color ? ((red > 0x80) && (green > 0x80) && (blue > 0x80)) : ((red + green + blue) > 3 * 0x80); // whitish
-                colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0)); // reddish or yellowish?
-                break;
-              case 16:
-                {
-                  uint8_t lsb = input_buffer[in_idx++];
-                  uint8_t msb = input_buffer[in_idx++];
-                  if (format == 0) // 555
-                  {
-                    blue  = (lsb & 0x1F) << 3;
-                    green = ((msb & 0x03) << 6) | ((lsb & 0xE0) >> 2);
-                    red   = (msb & 0x7C) << 1;
-                  }
-                  else // 565
-                  {
-                    blue  = (lsb & 0x1F) << 3;
-                    green = ((msb & 0x07) << 5) | ((lsb & 0xE0) >> 3);
-                    red   = (msb & 0xF8);
-                  }
-                  whitish = with_color ? ((red > 0x80) && (green > 0x80) && (blue > 0x80)) : ((red + green + blue) > 3 * 0x80); // whitish
-                  colored = (red > 0xF0) || ((green > 0xF0) && (blue > 0xF0)); // reddish or yellowish?
-                }
-                break;
-              case 1:
-              case 4:
-              case 8:
-                {
-                  if (0 == in_bits)
-                  {
-                    in_byte = input_buffer[in_idx++];
-                    in_bits = 8;
-                  }
-                  uint16_t pn = (in_byte >> bitshift) & bitmask;
-                  whitish = mono_palette_buffer[pn / 8] & (0x1 << pn % 8);
-                  colored = color_palette_buffer[pn / 8] & (0x1 << pn % 8);
-                  in_byte <<= depth;
-                  in_bits -= depth;
-                }
-                break;
-            }
-            if (whitish)
-            {
-              // keep white
-            }
-            else if (colored && with_color)
-            {
-              out_color_byte &= ~(0x80 >> col % 8); // colored
-            }
-            else
-            {
-              out_byte &= ~(0x80 >> col % 8); // black
-            }
-            if ((7 == col % 8) || (col == w - 1)) // write that last byte! (for w%8!=0 border)
-            {
-              output_row_color_buffer[out_idx] = out_color_byte;
-              output_row_mono_buffer[out_idx++] = out_byte;
-              out_byte = 0xFF; // white (for w%8!=0 border)
-              out_color_byte = 0xFF; // white (for w%8!=0 border)
-            }
-          } // end pixel
-          uint16_t yrow = y + (flip ? h - row - 1 : row);
-          display.writeImage(output_row_mono_buffer, output_row_color_buffer, x, yrow, w, 1);
+            uint16_t count = min((uint16_t)(w - col), input_buffer_pixels);
+            uint32_t in_bytes = ((uint32_t)count * depth + 7) / 8;
+            if (file.read(input_buffer, in_bytes) != in_bytes) break;
+            kernel(input_buffer, col, count, with_color, format);
+          }
+          uint16_t yrow = flip ? h - row - 1 : row;
+          memcpy(black + yrow * rowBytes, output_row_mono_buffer, rowBytes);
+          if (color) memcpy(color + yrow * rowBytes, output_row_color_buffer, rowBytes);
         } // end line
+        frame.drawImage(black, color, x, y, w, h);
         Serial.print(F("loaded in ")); Serial.print(millis() - startTime); Serial.println(F(" ms"));
         // display.refresh();
       }
@@ -925,6 +2404,79 @@ float readBattery() {
   return esp_adc_cal_raw_to_voltage(value, &adc_chars)*2.0/1000.0;
 }
 
+void spanBegin(Stage stage) {
+  governCpu(stage, true);
+  spanStarts[stage] = micros();
+}
+
+void spanEnd(Stage stage) {
+  currentTrace.spans[stage] += micros() - spanStarts[stage];
+  governCpu(stage, false);
+}
+
+// Marks `stage` as running or not, and sets the CPU clock to the fastest
+// one the running stages ask for
+void governCpu(Stage stage, bool running) {
+  std::lock_guard<std::mutex> lock(governorLock);
+  if (running) {
+    runningStages |= 1UL << stage;
+  } else {
+    runningStages &= ~(1UL << stage);
+  }
+
+  CpuSpeed speed = CPU_SLOW;
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    if ((runningStages & (1UL << i)) && stageSpeeds[i] > speed) {
+      speed = stageSpeeds[i];
+    }
+  }
+  if (speed == cpuSpeed) return;
+  countCpuTime();
+  cpuSpeed = speed;
+  setCpuFrequencyMhz(cpuSpeedMhz[speed]);
+}
+
+// Adds the time since the last clock change to the current clock, under
+// governorLock while spans may run on the other core
+void countCpuTime() {
+  uint32_t now = micros();
+  currentTrace.speeds[cpuSpeed] += now - cpuSpeedSince;
+  cpuSpeedSince = now;
+}
+
+void printWakeTrace(const WakeTrace *trace) {
+  Serial.printf("dt %lu, awake %u us\r\n", trace->dt, trace->awake);
+  for (int i = 0; i < STAGE_COUNT; i++) {
+    if (trace->spans[i] > 0) {
+      Serial.printf("  %-18s %9u us\r\n", stageNames[i], trace->spans[i]);
+    }
+  }
+  for (int i = 0; i < CPU_SPEED_COUNT; i++) {
+    char label[16];
+    snprintf(label, sizeof(label), "at %u MHz", cpuSpeedMhz[i]);
+    Serial.printf("  %-18s %9u us\r\n", label, trace->speeds[i]);
+  }
+}
+
+// Stores this wake in the RTC ring, the oldest entry is overwritten
+void recordWakeTrace() {
+  currentTrace.dt = state.dt;
+  currentTrace.awake = micros();
+  countCpuTime();  // the network task is done, no lock needed
+  wakeTraces[wakeCount % WAKE_TRACE_COUNT] = currentTrace;
+  wakeCount++;
+  Serial.print(F("Wake timings: "));
+  printWakeTrace(&currentTrace);
+}
+
+void printWakeTraces() {
+  uint32_t first = wakeCount > WAKE_TRACE_COUNT ? wakeCount - WAKE_TRACE_COUNT : 0;
+  Serial.printf("Last %u wakes:\r\n", wakeCount - first);
+  for (uint32_t i = first; i < wakeCount; i++) {
+    printWakeTrace(&wakeTraces[i % WAKE_TRACE_COUNT]);
+  }
+}
+
 void loop() {
   Serial.println("Loop");
   Serial.println(ESP.getFreeHeap(), DEC);
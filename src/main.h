@@ -3,11 +3,18 @@
 #include <HTTPClient.h>
 #include <WiFiClientSecure.h>
 #include <time.h>
+#include <new>
+#include <atomic>
+#include <mutex>
 #include <FS.h>
 #include <LittleFS.h>
 #include <ArduinoJson.h>
+#include <JsonExtract.h>
 #include <TimeLib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
+#define ENABLE_GxEPD2_GFX 1  // page height picked at run time, see createDisplay()
 #include <GxEPD2_BW.h>
 #include <GxEPD2_3C.h>
 #include <Fonts/FreeMonoBold9pt7b.h>
@@ -17,6 +24,19 @@
 #include "fonts/FreeMonoBold48pt7b.h"
 #include "fonts/FreeMonoBold64pt7b.h"
 #include "esp_adc_cal.h"
+#include "esp_sntp.h"
+#include "driver/gpio.h"
+#include "esp32/rom/miniz.h"
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <lwip/sockets.h>
+#include <mbedtls/net_sockets.h>
+#include "esp_crt_bundle.h"
+#include "soc/rtc.h"
+#include "soc/rtc_cntl_reg.h"
+#include "esp32/rom/rtc.h"
+#include "esp32/rom/ets_sys.h"
+#endif
 
 #include <FS.h>
 
@@ -29,14 +49,19 @@ typedef struct {
   char password[32];
   char OWLocation[32];
   char OWApiKey[33];
+  char digestUrl[64];  // "" to call the API directly
+  uint8_t quietStart;  // local hours without wakes, [quietStart, quietEnd), none when equal
+  uint8_t quietEnd;
 } Settings;
 
+// No member initializers: kept in RTC memory by ForecastCache, which must not
+// be constructed on boot. Zero-initialized, the weather strings start empty.
 struct forecastDay {
   char day[4];
   int morningTemp;
-  char morningWeather[4] = "";
+  char morningWeather[4];
   int afternoonTemp;
-  char afternoonWeather[4] = "";
+  char afternoonWeather[4];
 };
 
 struct State {
@@ -52,16 +77,389 @@ struct State {
   forecastDay forecast[3];
 };
 
-typedef GxEPD2_3C < GxEPD2_583c_Z83, GxEPD2_583c_Z83::HEIGHT/4> Display;  // 648 x 480
+#define FORECAST_MAX_COUNT 40  // slots the forecast endpoint serves
+
+// Forecast part of the state from the last download. The endpoint publishes
+// a slot every 3 hours, so it is only fetched again once the first slot has
+// passed or the day changed.
+struct ForecastCache {
+  bool valid;
+  unsigned long expires;  // dt of the first slot
+  int day;                // local day of month of the download
+  int laterTime;
+  int laterTemp;
+  char laterWeather[4];
+  forecastDay forecast[3];
+};
+
+// Stages of a wake, timed by spanBegin/spanEnd
+enum Stage {
+  STAGE_READ_BATTERY,
+  STAGE_FS_BEGIN,
+  STAGE_LOAD_SETTINGS,
+  STAGE_CONNECT_WIFI,
+  STAGE_TLS_HANDSHAKE,
+  STAGE_REFRESH_WEATHER,
+  STAGE_REFRESH_FORECAST,
+  STAGE_REFRESH_DIGEST,
+  STAGE_SET_CLOCK,
+  STAGE_DISPLAY_INIT,
+  STAGE_DISPLAY_DATE,
+  STAGE_DISPLAY_SUNSET,
+  STAGE_DISPLAY_WEATHER,
+  STAGE_DISPLAY_FORECAST,
+  STAGE_DISPLAY_LAST_UPDATE,
+  STAGE_DISPLAY_BATTERY,
+  STAGE_DISPLAY_PAGE,
+  STAGE_DISPLAY_REFRESH,
+  STAGE_DISPLAY_HIBERNATE,
+  STAGE_COUNT
+};
+
+// CPU clocks the stages run at, see stageSpeeds
+enum CpuSpeed {
+  CPU_SLOW,  // 80 MHz, the lowest WiFi works at
+  CPU_FAST,  // 240 MHz, the speed the board boots at
+  CPU_SPEED_COUNT
+};
+
+// The next timer wakes as sleepDeep() planned them, for the wake stub to
+// tell the ones due for a refresh from those it can sleep through
+struct WakeStubPlan {
+  bool valid;              // a refresh succeeded once: the clock and offset are right
+  uint32_t ticksPerSecond; // of the RTC slow clock, ESP32 only
+  int32_t offset;          // of the last refresh
+  uint32_t sleptAt;        // local time the app went to sleep
+  uint32_t sleeping;       // s of the sleep in progress
+  uint32_t elapsed;        // s slept since sleptAt, up to the current wake
+  uint32_t scheduled;      // local time of the next wake on the refresh schedule
+  uint16_t batteryMv;      // battery when the app went to sleep
+  uint8_t quietStart;      // from the settings
+  uint8_t quietEnd;
+  uint16_t noopWakes;      // slept through by the stub since the app last ran
+};
+
+#define WAKE_TRACE_COUNT 8  // wakes kept in RTC memory
+
+struct WakeTrace {
+  unsigned long dt;                   // state.dt of that wake
+  uint32_t awake;                     // us from boot to deep sleep
+  uint32_t spans[STAGE_COUNT];        // us per stage, 0 if it didn't run
+  uint32_t speeds[CPU_SPEED_COUNT];   // us at each CPU clock
+};
+
+// Areas of the screen, each drawn by its own function into the composed frame
+enum RegionId {
+  REGION_DATE,
+  REGION_SUNSET,
+  REGION_WEATHER,
+  REGION_FORECAST,
+  REGION_LAST_UPDATE,
+  REGION_BATTERY,
+  REGION_COUNT
+};
+
+struct Region {
+  uint16_t x;
+  uint16_t y;
+  uint16_t w;
+  uint16_t h;
+  Stage stage;
+  void (*draw)();
+};
+
+#define ICON_ATLAS_MAGIC 0x01415045   // "EPA" and version 1, little-endian
+#define PACKED_ICON_MAGIC 0x01495045  // "EPI" and version 1, little-endian
+#define PACKED_ICON_COLOR 0x01        // a color plane follows the black one
+
+// Layout of data/icons/atlas.bin, written by tools/pack_icons.py: the header,
+// `count` index entries sorted by name, then the icons
+struct IconAtlasHeader {
+  uint32_t magic;
+  uint16_t count;
+  uint16_t reserved;
+};
+
+struct IconAtlasEntry {
+  char name[16];
+  uint32_t offset;  // from the start of the atlas
+};
+
+// An icon in the atlas, followed by its black plane and optional color plane
+struct PackedIconHeader {
+  uint32_t magic;
+  uint16_t width;
+  uint16_t height;
+  uint8_t flags;
+  uint8_t reserved[3];
+};
+
+#define STATE_BLOB_MAGIC 0x01535045  // "EPS" and version 1, little-endian
+#define STATE_BLOB_HEADER_SIZE 40    // up to the forecast days
+#define STATE_BLOB_DAY_SIZE 16
+#define STATE_BLOB_SIZE (STATE_BLOB_HEADER_SIZE + 3 * STATE_BLOB_DAY_SIZE)
+
+#define BMP_SIGNATURE 0x4D42        // "BM", little-endian
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_INFO_HEADER_SIZE 40     // BITMAPINFOHEADER, later versions are larger
+
+// BMP file and info header fields, checked against the file size by
+// parseBmpHeader() before any pixel is read
+struct BmpHeader {
+  uint32_t fileSize;
+  uint32_t imageOffset;
+  uint32_t headerSize;
+  int32_t width;
+  int32_t height;         // negative when rows are stored top to bottom
+  uint16_t planes;
+  uint16_t depth;         // bits per pixel
+  uint32_t format;        // 0 uncompressed, 3 bitfields (565)
+  uint32_t rowSize;       // bytes per row, padded to 4
+  uint32_t paletteOffset; // depth <= 8 only, the palette ends at imageOffset
+};
+
+typedef GxEPD2_583c_Z83 Panel;  // 648 x 480
+typedef GxEPD2_GFX Display;     // a GxEPD2_3C<Panel, page height>
+
+#define PANEL_BUSY_PIN 4  // low while the GD7965 refreshes
+
+// What the CPU does while the panel is busy, set when the display is created
+enum BusyWait {
+  BUSY_WAIT_POLL,        // delay(1) between reads of BUSY, see pollWhileBusy()
+  BUSY_WAIT_LIGHT_SLEEP  // light sleep until BUSY goes high, see sleepWhileBusy()
+};
+
+#define DISPLAY_BUSY_WAIT BUSY_WAIT_LIGHT_SLEEP
+#define BUSY_SLEEP_LIMIT 1000  // ms in light sleep before BUSY is read again, should its edge be missed
+
+#define DISPLAY_HEAP_RESERVE 16384  // left free after the page buffers
+// Also left while the network task runs, prepareDisplay() creates the
+// display before the forecast is in: its InflateStream, the dictionary of
+// which takes a single block, then the HTTP strings and what the TLS
+// connection already up still allocates
+#define NETWORK_HEAP_HEADROOM 12288
+#define NETWORK_HEAP_RESERVE (sizeof(tinfl_decompressor) + TINFL_LZ_DICT_SIZE + INFLATE_INPUT_SIZE + NETWORK_HEAP_HEADROOM)
+#define NETWORK_HEAP_BLOCK TINFL_LZ_DICT_SIZE
+
+#define DISPLAY_LIST_OPS 64
+#define DISPLAY_LIST_TEXT 16          // longest recorded string, NUL included
+#define DISPLAY_LIST_POOL 8192        // bytes for icons decoded from BMP files
+
+enum DrawOpType {
+  DRAW_TEXT,
+  DRAW_IMAGE,
+};
+
+// A recorded draw operation and the rows it covers, for culling
+struct DrawOp {
+  uint8_t type;
+  int16_t x;
+  int16_t y;                  // cursor for text, top left corner for images
+  int16_t top;
+  int16_t bottom;             // rows [top, bottom) touched
+  uint16_t w;
+  uint16_t h;
+  uint16_t color;
+  const GFXfont *font;
+  const uint8_t *black;       // planes, 1 = white, MSB first
+  const uint8_t *colorPlane;  // NULL when the image has no color
+  char text[DISPLAY_LIST_TEXT];
+};
+
+// Records the draw calls of a frame once, so the page loop replays them from
+// memory instead of running the draw functions (and their file and icon
+// decoding) again for every page. Same text API as the display.
+class DisplayList : public Print {
+  public:
+    void clear();
+    void setTextColor(uint16_t color);
+    void setFont(const GFXfont *font);
+    void setCursor(int16_t x, int16_t y);
+    void getTextBounds(const char *str, int16_t x, int16_t y, int16_t *x1, int16_t *y1, uint16_t *w, uint16_t *h);
+    size_t write(uint8_t c) override;
+    using Print::write;
+    void drawImage(const uint8_t *black, const uint8_t *color, int16_t x, int16_t y, uint16_t w, uint16_t h);
+    uint8_t *allocImage(uint16_t w, uint16_t h, bool with_color);
+    void replay(int16_t bandTop, int16_t bandBottom);
+    uint8_t size() const { return _length; }
+
+  private:
+    DrawOp *append(uint8_t type);
+    void closeText();
+
+    DrawOp _ops[DISPLAY_LIST_OPS];
+    uint8_t _length = 0;
+    uint8_t _pool[DISPLAY_LIST_POOL];
+    uint16_t _poolUsed = 0;
+    DrawOp *_text = NULL;       // text op being written to
+    const GFXfont *_font = NULL;
+    uint16_t _color = GxEPD_BLACK;
+    int16_t _cursorX = 0;
+    int16_t _cursorY = 0;
+};
+
+#define NETWORK_TASK_STACK 10240  // bytes, the TLS handshake being the deepest
+#define NETWORK_CORE 0            // with the WiFi driver, the render side stays on core 1
+#define STATE_POLL_INTERVAL 5     // ms between looks at the progress of the network task
+
+// How far the network task got filling `state`. Each value is published once
+// the fields it stands for are written, see publishState().
+enum StateProgress : uint8_t {
+  STATE_PENDING,
+  STATE_WEATHER,   // dt, offset, current weather, sunrise and sunset
+  STATE_COMPLETE,  // all of it
+  STATE_FAILED     // a request failed, whatever was written is not to be shown
+};
+
+#define WIFI_FAST_CONNECT_TIMEOUT 3000  // ms before falling back to a scan
+#define WIFI_CONNECT_TIMEOUT 15000      // ms for a scan, association and DHCP
+#define WIFI_LEASE_RENEWAL 43200        // s on the cached lease before asking DHCP again,
+                                        // half of the common 24 h lease as DHCP renews at
+
+// Access point and DHCP lease of the last connection, for connecting without
+// a scan or DHCP on the next wake
+struct WifiCache {
+  bool valid;
+  uint8_t bssid[6];
+  int32_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t leasedAt;  // time(NULL) of the DHCP lease, renewed after WIFI_LEASE_RENEWAL
+};
+
+#define TLS_SESSION_SIZE 2048         // serialized session, the server certificate included
+#define TLS_CONNECT_TIMEOUT 5000      // ms
+#define TLS_HANDSHAKE_TIMEOUT 10000   // ms
+#define HTTP_TIMEOUT 5000             // ms, for the response and each read
+#define NTP_TIMEOUT 2000              // ms
+#define NTP_SYNC_INTERVAL 86400       // s between NTP recalibrations
+
+// mbedTLS session of the last handshake (ID or ticket and master secret) as
+// written by mbedtls_ssl_session_save()
+struct TlsSession {
+  uint16_t length;  // 0: no session
+  uint8_t data[TLS_SESSION_SIZE];
+};
+
+// WiFiClientSecure offering the session saved in RTC memory, so the next
+// wake resumes it instead of doing the full public-key exchange. Only the
+// ESP32 build resumes, the host build is a plain WiFiClientSecure.
+class ResumingClientSecure : public WiFiClientSecure {
+  public:
+    int connect(const char *host, uint16_t port) override;
+    using WiFiClientSecure::connect;
+
+#ifdef ARDUINO_ARCH_ESP32
+  private:
+    int handshake(const char *host, uint16_t port, bool resume);
+#endif
+};
+
+// Body of an HTTP/1.1 response: undoes chunked transfer encoding and stops
+// where the body ends, so a kept-alive connection is left at the next response
+class HttpBodyStream : public Stream {
+  public:
+    HttpBodyStream(Stream &stream, bool chunked, int size);
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override { return 0; }
+    using Print::write;
+    void drain();
+
+  private:
+    int readRaw();
+    bool readLine(char *line, size_t size);
+    bool nextChunk();
+
+    Stream &_stream;
+    bool _chunked;
+    long _remaining;  // in the chunk or the body, -1 when the body ends with the connection
+    bool _end = false;
+    int _peeked = -1;
+};
+
+#define INFLATE_INPUT_SIZE 512  // compressed bytes read from the body at a time
+
+// Inflates a gzip body (Content-Encoding: gzip) as it is read, with the tinfl
+// decompressor of the ROM. The decompressor and its 32 kB dictionary are only
+// allocated on the first read, and freed with the stream.
+class InflateStream : public Stream {
+  public:
+    InflateStream(Stream &source) : _source(source) {}
+    ~InflateStream();
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override { return 0; }
+    using Print::write;
+
+  private:
+    InflateStream(const InflateStream &);
+    InflateStream &operator=(const InflateStream &);
+    bool begin();
+    bool skipHeader();
+    bool fill();
+
+    Stream &_source;
+    tinfl_decompressor *_decompressor = NULL;
+    uint8_t *_dict = NULL;  // TINFL_LZ_DICT_SIZE, the output wraps around it
+    uint8_t *_input = NULL;
+    size_t _inputPos = 0;
+    size_t _inputLength = 0;
+    bool _sourceEnd = false;
+    size_t _dictPos = 0;    // where the next output goes
+    size_t _outputPos = 0;  // unread output in _dict
+    size_t _outputLength = 0;
+    bool _started = false;
+    bool _end = false;
+};
 
+Display *createDisplay(uint32_t reserve, BusyWait busyWait);
+void pollWhileBusy(const void *parameter);
+void sleepWhileBusy(const void *parameter);
+bool parseBmpHeader(const uint8_t *data, size_t length, size_t fileSize, BmpHeader *bmp);
+bool parseStateBlob(const uint8_t *data, size_t length, State *state);
 void drawBitmapFromSpiffs(const char *filename, int16_t x, int16_t y, bool with_color = true);
-void refreshData();
+void drawIcon(const char *name, int16_t x, int16_t y);
+bool refreshData();
+void networkTask(void *parameter);
+void publishState(StateProgress progress);
+uint8_t waitForState(StateProgress progress);
+bool refreshFromApi(Settings *settings);
+bool refreshDigest(Settings *settings);
+HttpBodyStream responseBody(HTTPClient *http);
 void printState();
+void prepareDisplay();
+bool initDisplay(uint32_t reserve, uint32_t block);
+bool growDisplay();
 void refreshDisplay();
+void recordRegions(uint8_t regionMask);
+uint8_t composeFrame(uint8_t regionMask, bool fullWindow);
 void loadSettings(Settings* settings);
-void connectToWifi(Settings *settings);
+void countFailedRefresh();
+bool mountFs();
+void unmountFs();
+bool connectToWifi(Settings *settings);
+bool waitForWifi(unsigned long timeout);
 void disconnectWifi();
 void setClock();
-void refreshWeather(Settings *settings, WiFiClientSecure *client);
-void refreshForecast(Settings *settings, WiFiClientSecure *client);
-float readBattery();
\ No newline at end of file
+time_t parseHttpDate(const char *date);
+void setClockFromResponse(time_t date);
+bool refreshWeather(Settings *settings, WiFiClientSecure *client, HTTPClient *http);
+bool refreshForecast(Settings *settings, WiFiClientSecure *client, HTTPClient *http);
+bool forecastExpired();
+void restoreForecast();
+float readBattery();
+void spanBegin(Stage stage);
+void spanEnd(Stage stage);
+void governCpu(Stage stage, bool running);
+void countCpuTime();
+void recordWakeTrace();
+void planWakeStub(uint32_t seconds);
+uint32_t scheduleWake();
+uint32_t refreshInterval();
+bool isQuietHour(uint32_t hour, uint8_t start, uint8_t end);
+void printWakeTraces();
\ No newline at end of file
@@ -0,0 +1,271 @@
+// Unit tests of lib/JsonExtract, run on the host:
+//
+//   pio test -e native
+
+#include <Arduino.h>
+#include <JsonExtract.h>
+#include <unity.h>
+
+#include <string>
+
+// A response body already received
+class StringStream : public Stream {
+  public:
+    StringStream(const char *data) : _data(data) {}
+    int available() override { return _data.size() - _pos; }
+    int read() override { return _pos < _data.size() ? (uint8_t)_data[_pos++] : -1; }
+    int peek() override { return _pos < _data.size() ? (uint8_t)_data[_pos] : -1; }
+    size_t write(uint8_t) override { return 0; }
+    using Print::write;
+
+  private:
+    std::string _data;
+    size_t _pos = 0;
+};
+
+#define FIELD_COUNT(fields) (sizeof(fields) / sizeof(fields[0]))
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_fields_at_their_paths() {
+  StringStream stream(
+    "{\"dt\":1700000000,\"timezone\":3600,\"main\":{\"temp\":12.5},"
+    "\"weather\":[{\"icon\":\"01d\"},{\"icon\":\"02n\"}],\"sys\":{\"sunset\":1700030000}}");
+  long dt = 0, sunset = 0;
+  int offset = 0;
+  float temp = 0;
+  char icon[4] = "";
+  char secondIcon[4] = "";
+  const JsonField fields[] = {
+    {"dt", JSON_LONG, &dt, 0},
+    {"timezone", JSON_INT, &offset, 0},
+    {"main.temp", JSON_FLOAT, &temp, 0},
+    {"weather[0].icon", JSON_STRING, icon, sizeof(icon)},
+    {"weather[1].icon", JSON_STRING, secondIcon, sizeof(secondIcon)},
+    {"sys.sunset", JSON_LONG, &sunset, 0},
+  };
+  TEST_ASSERT_TRUE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL(1700000000, dt);
+  TEST_ASSERT_EQUAL_INT(3600, offset);
+  TEST_ASSERT_EQUAL_FLOAT(12.5f, temp);
+  TEST_ASSERT_EQUAL_STRING("01d", icon);
+  TEST_ASSERT_EQUAL_STRING("02n", secondIcon);
+  TEST_ASSERT_EQUAL(1700030000, sunset);
+}
+
+void test_escapes() {
+  StringStream stream("{\"a\":\"q\\\"b\\\\s\\/n\\nt\\t\",\"b\":\"\\u00e9t\\u00e9\",\"c\":\"\\x\"}");
+  char a[16] = "";
+  char b[16] = "";
+  const JsonField fields[] = {
+    {"a", JSON_STRING, a, sizeof(a)},
+    {"b", JSON_STRING, b, sizeof(b)},
+  };
+  // \x is no escape of JSON
+  TEST_ASSERT_FALSE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL_STRING("q\"b\\s/n\nt\t", a);
+  // anything but ASCII reads as '?'
+  TEST_ASSERT_EQUAL_STRING("?t?", b);
+}
+
+void test_escapes_in_keys() {
+  StringStream stream("{\"t\\u0065mp\":1,\"te\\\"mp\":2,\"temp\":3}");
+  int temp = 0;
+  const JsonField fields[] = {
+    {"temp", JSON_INT, &temp, 0},
+  };
+  TEST_ASSERT_TRUE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL_INT(3, temp);
+}
+
+void test_string_truncated_in_destination() {
+  StringStream stream("{\"icon\":\"01dxyz\",\"next\":\"02d\"}");
+  char icon[4] = "";
+  char next[4] = "";
+  const JsonField fields[] = {
+    {"icon", JSON_STRING, icon, sizeof(icon)},
+    {"next", JSON_STRING, next, sizeof(next)},
+  };
+  TEST_ASSERT_TRUE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL_STRING("01d", icon);
+  TEST_ASSERT_EQUAL_STRING("02d", next);
+}
+
+// A key longer than what is left of the path must not match the field its
+// truncation spells
+void test_key_truncated_in_path() {
+  std::string key(JSON_PATH_SIZE - 1, 'k');
+  std::string longKey(JSON_PATH_SIZE + 8, 'k');
+  std::string json = "{\"" + longKey + "\":1,\"" + key + "\":2,\"o\":{\"" + longKey + "\":{\"x\":3}},\"after\":4}";
+  StringStream stream(json.c_str());
+  int value = 0, after = 0;
+  const JsonField fields[] = {
+    {key.c_str(), JSON_INT, &value, 0},
+    {"after", JSON_INT, &after, 0},
+  };
+  TEST_ASSERT_TRUE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL_INT(2, value);
+  TEST_ASSERT_EQUAL_INT(4, after);
+}
+
+// The path of a field nested past the path size is never reached, the rest
+// is still read
+void test_path_full() {
+  std::string key(JSON_PATH_SIZE - 3, 'k');
+  std::string json = "{\"" + key + "\":{\"deep\":1},\"b\":2}";
+  StringStream stream(json.c_str());
+  int deep = 0, b = 0;
+  std::string path = key + ".deep";
+  const JsonField fields[] = {
+    {path.c_str(), JSON_INT, &deep, 0},
+    {"b", JSON_INT, &b, 0},
+  };
+  TEST_ASSERT_TRUE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL_INT(0, deep);
+  TEST_ASSERT_EQUAL_INT(2, b);
+}
+
+static std::string nested(int levels, const char *inner) {
+  return std::string(levels, '[') + inner + std::string(levels, ']');
+}
+
+void test_nesting_limit() {
+  int value = 0;
+  std::string path;
+  for (int i = 0; i < JSON_NESTING_LIMIT; i++) path += "[0]";
+  const JsonField fields[] = {
+    {path.c_str(), JSON_INT, &value, 0},
+  };
+
+  StringStream atLimit(nested(JSON_NESTING_LIMIT, "7").c_str());
+  TEST_ASSERT_TRUE(extractJson(atLimit, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL_INT(7, value);
+
+  StringStream pastLimit(nested(JSON_NESTING_LIMIT + 1, "8").c_str());
+  TEST_ASSERT_FALSE(extractJson(pastLimit, fields, 0));
+
+  // skipped subtrees count as well
+  std::string skipped = "{\"a\":" + nested(JSON_NESTING_LIMIT, "1") + "}";
+  StringStream pastLimitSkipped(skipped.c_str());
+  TEST_ASSERT_FALSE(extractJson(pastLimitSkipped, fields, 0));
+}
+
+void test_missing_and_wrong_typed_fields() {
+  StringStream stream("{\"dt\":\"soon\",\"temp\":null,\"icon\":42,\"main\":[1],\"list\":{\"0\":1}}");
+  long dt = -1;
+  float temp = -1;
+  char icon[4] = "x";
+  int mainTemp = -1, first = -1, missing = -1;
+  const JsonField fields[] = {
+    {"dt", JSON_LONG, &dt, 0},
+    {"temp", JSON_FLOAT, &temp, 0},
+    {"icon", JSON_STRING, icon, sizeof(icon)},
+    {"main.temp", JSON_INT, &mainTemp, 0},
+    {"list[0]", JSON_INT, &first, 0},
+    {"missing", JSON_INT, &missing, 0},
+  };
+  TEST_ASSERT_TRUE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL(-1, dt);
+  TEST_ASSERT_EQUAL_FLOAT(-1, temp);
+  TEST_ASSERT_EQUAL_STRING("x", icon);
+  TEST_ASSERT_EQUAL_INT(-1, mainTemp);
+  TEST_ASSERT_EQUAL_INT(-1, first);
+  TEST_ASSERT_EQUAL_INT(-1, missing);
+}
+
+void test_numbers() {
+  StringStream stream("[-3.7,1.5e2,-2E-1,12.9,-1700000000,true,false,null]");
+  int negative = 0, truncated = 0;
+  long exponent = 0, big = 0;
+  float small = 0;
+  const JsonField fields[] = {
+    {"[0]", JSON_INT, &negative, 0},
+    {"[1]", JSON_LONG, &exponent, 0},
+    {"[2]", JSON_FLOAT, &small, 0},
+    {"[3]", JSON_INT, &truncated, 0},
+    {"[4]", JSON_LONG, &big, 0},
+  };
+  TEST_ASSERT_TRUE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL_INT(-3, negative);
+  TEST_ASSERT_EQUAL(150, exponent);
+  TEST_ASSERT_EQUAL_FLOAT(-0.2f, small);
+  TEST_ASSERT_EQUAL_INT(12, truncated);
+  TEST_ASSERT_EQUAL(-1700000000, big);
+}
+
+void test_bad_numbers_and_literals() {
+  StringStream badNumber("[1.2.3]");
+  TEST_ASSERT_FALSE(extractJson(badNumber, NULL, 0));
+  StringStream badLiteral("[nope]");
+  TEST_ASSERT_FALSE(extractJson(badLiteral, NULL, 0));
+  std::string longNumber = "[" + std::string(JSON_NUMBER_SIZE, '1') + "]";
+  StringStream tooLong(longNumber.c_str());
+  TEST_ASSERT_FALSE(extractJson(tooLong, NULL, 0));
+}
+
+void test_keys_sharing_a_prefix() {
+  StringStream stream("{\"main\":{\"temp_min\":1.5,\"temp\":20.5,\"temp_max\":30.5},\"maintenance\":{\"temp\":99}}");
+  float temp = 0;
+  const JsonField fields[] = {
+    {"main.temp", JSON_FLOAT, &temp, 0},
+  };
+  TEST_ASSERT_TRUE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL_FLOAT(20.5f, temp);
+}
+
+void test_early_end() {
+  const char *cut[] = {
+    "{\"dt\":17",
+    "{\"dt\":1700000000",
+    "{\"dt\":1700000000,",
+    "{\"icon\":\"01",
+    "{\"icon\":\"\\u00",
+    "{\"list\":[1,2",
+    "{\"di",
+    "",
+  };
+  for (size_t i = 0; i < sizeof(cut) / sizeof(cut[0]); i++) {
+    long dt = 0;
+    char icon[4] = "";
+    const JsonField fields[] = {
+      {"dt", JSON_LONG, &dt, 0},
+      {"icon", JSON_STRING, icon, sizeof(icon)},
+    };
+    StringStream stream(cut[i]);
+    TEST_ASSERT_FALSE_MESSAGE(extractJson(stream, fields, FIELD_COUNT(fields)), cut[i]);
+  }
+}
+
+// Nothing is read past the value, refreshForecast() goes on from there
+void test_stops_after_the_value() {
+  StringStream stream("{\"dt\":1} ,{\"dt\":2}");
+  long dt = 0;
+  const JsonField fields[] = {
+    {"dt", JSON_LONG, &dt, 0},
+  };
+  TEST_ASSERT_TRUE(extractJson(stream, fields, FIELD_COUNT(fields)));
+  TEST_ASSERT_EQUAL(1, dt);
+  TEST_ASSERT_EQUAL(' ', stream.read());
+}
+
+void setup() {
+  UNITY_BEGIN();
+  RUN_TEST(test_fields_at_their_paths);
+  RUN_TEST(test_escapes);
+  RUN_TEST(test_escapes_in_keys);
+  RUN_TEST(test_string_truncated_in_destination);
+  RUN_TEST(test_key_truncated_in_path);
+  RUN_TEST(test_path_full);
+  RUN_TEST(test_nesting_limit);
+  RUN_TEST(test_missing_and_wrong_typed_fields);
+  RUN_TEST(test_numbers);
+  RUN_TEST(test_bad_numbers_and_literals);
+  RUN_TEST(test_keys_sharing_a_prefix);
+  RUN_TEST(test_early_end);
+  RUN_TEST(test_stops_after_the_value);
+  exit(UNITY_END());
+}
+
+void loop() {}
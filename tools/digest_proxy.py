@@ -0,0 +1,225 @@
+#!/usr/bin/env python3
+#
+# Digest proxy for the station: fetches the current weather and the forecast
+# from OpenWeather, does the aggregation refreshForecast() does on the board,
+# and serves the result as a small binary blob that maps field for field to
+# struct State. The station then makes one ~100 byte request per wake instead
+# of two JSON ones, over plain HTTP if the proxy is on a trusted network.
+#
+#   GET /state?q=<location>[&APPID=<key>]
+#
+# The API key is better set on the proxy (--api-key): stations with no
+# OWApiKey in their settings then send none. Keys are never logged. Upstream
+# responses are cached per location (--cache) for stations sharing one.
+#
+# Blob format (little-endian), STATE_BLOB_* in src/main.h:
+#   0   magic 'EPS' and version 1
+#   4   uint32 dt
+#   8   int32 offset (timezone, s)
+#   12  int16 currentTemp
+#   14  char currentWeather[4]
+#   18  int32 laterTime (local)
+#   22  int16 laterTemp
+#   24  char laterWeather[4]
+#   28  char todaySunrise[6]
+#   34  char todaySunset[6]
+#   40  3 forecast days of 16 bytes:
+#         char day[4]
+#         int16 morningTemp
+#         char morningWeather[4]
+#         int16 afternoonTemp
+#         char afternoonWeather[4]
+#   88  end
+# Strings are NUL padded.
+#
+# usage: python digest_proxy.py [--port 8080] [--api-key KEY]
+#        python digest_proxy.py --fixtures ../lib/NativeShims/fixtures   (stand-in upstream)
+#        python digest_proxy.py --fixtures DIR --output state.bin -q LOCATION   (one blob, no server)
+
+import argparse
+import json
+import math
+import os
+import re
+import struct
+import sys
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.error import URLError
+from urllib.parse import parse_qs, quote, urlparse
+from urllib.request import urlopen
+
+STATE_MAGIC = b'EPS\x01'
+STATE_FORMAT = '<4sIih4sih4s6s6s'
+DAY_FORMAT = '<4sh4sh4s'
+FORECAST_DAYS = 3
+UPSTREAM = 'https://api.openweathermap.org/data/2.5'
+WEEKDAYS = ['Sun', 'Mon', 'Tue', 'Wed', 'Thu', 'Fri', 'Sat']
+API_KEY = re.compile(r'(APPID=)[^&\s"]*', re.IGNORECASE)
+
+
+class Upstream(object):
+    """ The OpenWeather API, or recorded responses standing in for it """
+
+    def __init__(self, base, fixtures, timeout):
+        self.base = base
+        self.fixtures = fixtures
+        self.timeout = timeout
+
+    def get(self, endpoint, location, key):
+        if self.fixtures:
+            with open(os.path.join(self.fixtures, endpoint + '.json'), 'rb') as f:
+                return json.load(f)
+        url = '%s/%s?q=%s&units=metric&APPID=%s' % (self.base, endpoint, quote(location, safe=',%'), quote(key))
+        with urlopen(url, timeout=self.timeout) as response:
+            return json.load(response)
+
+
+def c_round(x):
+    """ round() of C: halves away from zero """
+    return int(math.copysign(math.floor(abs(x) + 0.5), x))
+
+
+def hhmm(t):
+    tm = time.gmtime(t)
+    return '%02d:%02d' % (tm.tm_hour, tm.tm_min)
+
+
+def digest(weather, forecast):
+    """ The State the station would build from the two responses """
+    dt = weather['dt']
+    offset = weather['timezone']
+    current_time = dt + offset
+    entries = forecast['list']
+
+    later = entries[1]
+    later_time = later['dt'] + offset
+
+    # the slot selection of refreshForecast(), quirks included
+    days = [['', 0, '', 0, ''] for _ in range(FORECAST_DAYS)]
+    day_index = 0
+    for entry in entries:
+        if day_index >= FORECAST_DAYS:
+            break
+        t = entry['dt'] + offset
+        tm = time.gmtime(t)
+        if not (7 <= tm.tm_hour < 10 or 16 <= tm.tm_hour < 19):
+            continue
+        if tm.tm_mday == time.gmtime(current_time).tm_mday:
+            continue
+        day = days[day_index]
+        temp = int(entry['main']['temp'])
+        icon = entry['weather'][0]['icon']
+        if day[2] == '':
+            day[0] = WEEKDAYS[(tm.tm_wday + 1) % 7]
+            day[1] = temp
+            day[2] = icon
+        else:
+            day[3] = temp
+            day[4] = icon
+            day_index += 1
+
+    blob = struct.pack(STATE_FORMAT, STATE_MAGIC, dt, offset,
+                       c_round(weather['main']['temp']), weather['weather'][0]['icon'].encode(),
+                       later_time, int(later['main']['temp']), later['weather'][0]['icon'].encode(),
+                       hhmm(weather['sys']['sunrise'] + offset).encode(),
+                       hhmm(weather['sys']['sunset'] + offset).encode())
+    for name, morning_temp, morning_icon, afternoon_temp, afternoon_icon in days:
+        blob += struct.pack(DAY_FORMAT, name.encode(), morning_temp, morning_icon.encode(),
+                            afternoon_temp, afternoon_icon.encode())
+    return blob
+
+
+class Digests(object):
+    """ Blobs by location, fetched again once older than `ttl` seconds """
+
+    def __init__(self, upstream, api_key, ttl):
+        self.upstream = upstream
+        self.api_key = api_key
+        self.ttl = ttl
+        self.cache = {}
+        self.lock = threading.Lock()
+
+    def get(self, location, key):
+        key = self.api_key or key
+        with self.lock:
+            cached = self.cache.get(location)
+            if cached and time.time() - cached[0] < self.ttl:
+                return cached[1]
+        blob = digest(self.upstream.get('weather', location, key), self.upstream.get('forecast', location, key))
+        with self.lock:
+            self.cache[location] = (time.time(), blob)
+        return blob
+
+
+def handler(digests):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = 'HTTP/1.1'
+
+        def do_GET(self):
+            url = urlparse(self.path)
+            query = parse_qs(url.query)
+            if url.path != '/state' or 'q' not in query:
+                self.send_error(404)
+                return
+            if not (digests.api_key or digests.upstream.fixtures or query.get('APPID', [''])[0]):
+                self.send_error(403, 'no API key, set --api-key')
+                return
+            try:
+                blob = digests.get(query['q'][0], query.get('APPID', [''])[0])
+            except (URLError, OSError, ValueError, KeyError, IndexError) as e:
+                self.log_error('upstream: %s', e)
+                self.send_error(502)
+                return
+            self.send_response(200)  # with the Date header the station sets its clock from
+            self.send_header('Content-Type', 'application/octet-stream')
+            self.send_header('Content-Length', str(len(blob)))
+            self.end_headers()
+            self.wfile.write(blob)
+
+        def log_message(self, format, *args):
+            # the request line holds the key of stations sending theirs
+            message = API_KEY.sub(r'\1***', format % args)
+            sys.stderr.write('%s - - [%s] %s\n' % (self.address_string(), self.log_date_time_string(), message))
+
+    return Handler
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Serve the station its state, digested from the OpenWeather API')
+    parser.add_argument('--port', type=int, default=8080, help='port to listen on')
+    parser.add_argument('--bind', default='', help='address to listen on')
+    parser.add_argument('--api-key', help='OpenWeather API key, instead of the one the station sends')
+    parser.add_argument('--upstream', default=UPSTREAM, help='base URL of the API')
+    parser.add_argument('--fixtures', help='answer from <fixtures>/<endpoint>.json instead of the API')
+    parser.add_argument('--cache', type=int, default=600, help='seconds an upstream response is reused')
+    parser.add_argument('--timeout', type=float, default=10, help='upstream timeout in seconds')
+    parser.add_argument('--output', help='write the blob for -q to this file and exit')
+    parser.add_argument('-q', '--location', default='san francisco,US', help='location for --output')
+    args = parser.parse_args()
+
+    digests = Digests(Upstream(args.upstream, args.fixtures, args.timeout), args.api_key, args.cache)
+
+    if args.output:
+        try:
+            blob = digests.get(args.location, args.api_key or '')
+        except (URLError, OSError, ValueError, KeyError, IndexError) as e:
+            sys.stderr.write('digest_proxy.py: %s\n' % e)
+            return 1
+        with open(args.output, 'wb') as f:
+            f.write(blob)
+        print('%s: %d bytes' % (args.output, len(blob)))
+        return 0
+
+    server = ThreadingHTTPServer((args.bind, args.port), handler(digests))
+    print('serving on port %d' % args.port)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,166 @@
+#!/usr/bin/env python
+#
+# Packs the BMP icons into the atlas embedded in the firmware and drawn by
+# drawIcon(): the black and color planes are stored exactly as GxEPD2's
+# drawInvertedBitmap() takes them, so an icon is drawn straight from flash
+# with no decoding.
+#
+# Atlas format (little-endian):
+#   0   magic 'EPA' and version 1
+#   4   uint16 icon count
+#   6   2 bytes reserved
+#   8   index, one entry per icon sorted by name:
+#         char name[16], NUL padded (file name without .bmp)
+#         uint32 offset of the icon from the start of the atlas
+#   ..  icons, each 4-byte aligned:
+#         0   magic 'EPI' and version 1
+#         4   uint16 width
+#         6   uint16 height
+#         8   uint8 flags, bit 0: a color plane follows the black plane
+#         9   3 bytes reserved
+#         12  black plane, ((width + 7) / 8) * height bytes, rows top to
+#             bottom, MSB first, 1 = white
+#         ..  color plane, same layout, 1 = not colored
+#
+# Pixels are classified like drawBitmapFromSpiffs() does.
+#
+# usage: python pack_icons.py [--color] [-o atlas] [bmp ...]
+#        (without files, every icon in ../data is packed)
+
+import argparse
+import glob
+import os
+import struct
+import sys
+
+ATLAS_MAGIC = b'EPA\x01'
+ICON_MAGIC = b'EPI\x01'
+FLAG_COLOR = 0x01
+NAME_SIZE = 16
+
+
+def read_bmp(path):
+    """ Returns (width, height, rows of (r, g, b)), top row first """
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:2] != b'BM':
+        raise ValueError('not a BMP file')
+    image_offset, = struct.unpack_from('<I', data, 10)
+    header_size, width, height, planes, depth, compression = struct.unpack_from('<IiiHHI', data, 14)
+    if planes != 1 or compression not in (0, 3):
+        raise ValueError('compressed BMP not handled')
+    flip = height > 0
+    height = abs(height)
+    row_size = ((width * depth + 31) // 32) * 4
+
+    palette = []
+    if depth <= 8:
+        palette_offset = image_offset - (4 << depth)
+        for i in range(1 << depth):
+            b, g, r = data[palette_offset + 4 * i:palette_offset + 4 * i + 3]
+            palette.append((r, g, b))
+
+    rows = []
+    for row in range(height):
+        start = image_offset + row * row_size
+        line = data[start:start + row_size]
+        pixels = []
+        for col in range(width):
+            if depth <= 8:
+                bit = col * depth
+                index = (line[bit // 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1)
+                pixels.append(palette[index])
+            elif depth == 16:
+                lsb, msb = line[2 * col], line[2 * col + 1]
+                if compression == 0:  # 555
+                    pixels.append(((msb & 0x7C) << 1, ((msb & 0x03) << 6) | ((lsb & 0xE0) >> 2), (lsb & 0x1F) << 3))
+                else:  # 565
+                    pixels.append((msb & 0xF8, ((msb & 0x07) << 5) | ((lsb & 0xE0) >> 3), (lsb & 0x1F) << 3))
+            elif depth == 24:
+                b, g, r = line[3 * col:3 * col + 3]
+                pixels.append((r, g, b))
+            else:
+                raise ValueError('%d bpp not handled' % depth)
+        rows.append(pixels)
+    if flip:
+        rows.reverse()
+    return width, height, rows
+
+
+def pack(width, height, rows, with_color):
+    black = bytearray()
+    color = bytearray()
+    has_color = False
+    for pixels in rows:
+        for byte_start in range(0, width, 8):
+            black_byte = 0xFF
+            color_byte = 0xFF
+            for bit, (r, g, b) in enumerate(pixels[byte_start:byte_start + 8]):
+                if with_color:
+                    whitish = r > 0x80 and g > 0x80 and b > 0x80
+                else:
+                    whitish = r + g + b > 3 * 0x80
+                colored = r > 0xF0 or (g > 0xF0 and b > 0xF0)
+                if whitish:
+                    pass
+                elif colored and with_color:
+                    color_byte &= ~(0x80 >> bit)
+                    has_color = True
+                else:
+                    black_byte &= ~(0x80 >> bit)
+            black.append(black_byte)
+            color.append(color_byte)
+    flags = FLAG_COLOR if has_color else 0
+    out = ICON_MAGIC + struct.pack('<HHB3x', width, height, flags) + bytes(black)
+    if has_color:
+        out += bytes(color)
+    return out
+
+
+def atlas(icons):
+    """ icons: list of (name, packed icon) """
+    icons = sorted(icons)
+    offset = len(ATLAS_MAGIC) + 4 + len(icons) * (NAME_SIZE + 4)
+    index = bytearray()
+    body = bytearray()
+    for name, icon in icons:
+        if len(name) >= NAME_SIZE:
+            raise ValueError('icon name too long: %s' % name)
+        index += struct.pack('<%dsI' % NAME_SIZE, name.encode('ascii'), offset + len(body))
+        body += icon
+        body += b'\0' * (-len(body) % 4)
+    return ATLAS_MAGIC + struct.pack('<H2x', len(icons)) + bytes(index) + bytes(body)
+
+
+def main():
+    data_dir = os.path.relpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'data'))
+    parser = argparse.ArgumentParser(description='Pack BMP icons into an atlas of GxEPD2 black/color planes')
+    parser.add_argument('--color', action='store_true', help='keep red pixels in a color plane')
+    parser.add_argument('-o', '--output', default=os.path.join(data_dir, 'icons', 'atlas.bin'), help='atlas file')
+    parser.add_argument('files', nargs='*', help='BMP files')
+    args = parser.parse_args()
+
+    files = args.files or sorted(glob.glob(os.path.join(data_dir, '*.bmp')))
+
+    icons = []
+    for path in files:
+        try:
+            width, height, rows = read_bmp(path)
+        except ValueError as e:
+            sys.stderr.write('pack_icons.py: %s: %s\n' % (path, e))
+            return 1
+        name = os.path.splitext(os.path.basename(path))[0]
+        icons.append((name, pack(width, height, rows, args.color)))
+
+    out = atlas(icons)
+    out_dir = os.path.dirname(args.output)
+    if out_dir and not os.path.isdir(out_dir):
+        os.makedirs(out_dir)
+    with open(args.output, 'wb') as f:
+        f.write(out)
+    print('%s: %d icons, %d bytes' % (args.output, len(icons), len(out)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())